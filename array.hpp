@@ -130,6 +130,15 @@ T* array_pushn(Array<T> &a, int n) {
 	return a.items + a.size - n;
 }
 
+template<class T>
+void array_shrink(Array<T> &a) {
+	int newcap = a.size ? a.size : 1;
+	if (newcap >= a.cap)
+		return;
+	a.items = (T*)ARRAY_REALLOC(a.items, newcap * sizeof(T));
+	a.cap = newcap;
+}
+
 template<class T>
 void array_pusha(Array<T> &a, T *items, int n) {
 	array_pushn(a, n);
@@ -1,3 +1,10 @@
 #!/usr/bin/env bash
 # RELEASE_FLAGS="-O3"
-g++ mineclone.cpp -o mineclone.out -Wall -Wextra -Wno-unused-function -Wno-unused-but-set-variable -std=c++11 -g ${RELEASE_FLAGS} -ffast-math -Iinclude -L. -lGL -lSDL2 -ldl -fno-sanitize-recover -fsanitize=undefined -fsanitize=address
+# ./build.sh bench builds just the benchmarks into mineclone_bench.out, without SDL or OpenGL (see BENCH_ONLY in mineclone.cpp).
+# The drawing code is still compiled there, so --gc-sections drops it, since nothing calls it
+FLAGS="-Wall -Wextra -Wno-unused-function -Wno-unused-but-set-variable -std=c++11 -g ${RELEASE_FLAGS} -ffast-math -Iinclude"
+if [ "$1" == "bench" ]; then
+  g++ mineclone.cpp -o mineclone_bench.out -DBENCH_ONLY ${FLAGS} -ffunction-sections -fdata-sections -Wl,--gc-sections -ldl -pthread -fno-sanitize-recover -fsanitize=undefined -fsanitize=address
+else
+  g++ mineclone.cpp -o mineclone.out ${FLAGS} -L. -lGL -lSDL2 -ldl -pthread -fno-sanitize-recover -fsanitize=undefined -fsanitize=address
+fi
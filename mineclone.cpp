@@ -21,8 +21,6 @@
 //
 // * bloom (https://learnopengl.com/Advanced-Lighting/Bloom)
 //
-// * ambient occlusion (https://learnopengl.com/Advanced-Lighting/SSAO)
-//
 // * antialiasing (https://learnopengl.com/Advanced-OpenGL/Anti-Aliasing)
 //
 // * more ui (menus, buttons, etc..)
@@ -70,15 +68,42 @@
   #define MANUAL_GAMMA
 #endif
 
+// BENCH_ONLY builds just the benchmarks, without SDL (see build.sh). They never open a window, so they don't need it
 #include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "GL/gl3w.h"
-#include "SDL2/SDL.h"
+#ifndef BENCH_ONLY
+  #include "SDL2/SDL.h"
+#endif
 #include <math.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "array.hpp"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#include "GL/gl3w.c"
+#ifndef BENCH_ONLY
+  #include "GL/gl3w.c"
+#endif
 #include <stdint.h>
+#ifdef OS_WINDOWS
+  #include <direct.h>
+  #include <intrin.h>
+  #include <windows.h>
+  #include <psapi.h>
+  #include <sys/utime.h>
+  #pragma comment(lib, "psapi.lib")
+#else
+  #include <sys/stat.h>
+  #include <sys/resource.h>
+  #include <dirent.h>
+  #include <unistd.h>
+  #include <utime.h>
+#endif
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "stb_truetype.h"
@@ -130,6 +155,7 @@ static void _die(const char *file, int line, const char *fmt, ...) {
   #define debug_verbose(stmt)
 #endif
 
+#ifndef BENCH_ONLY
 static void _sdl_die(const char *file, int line, const char *fmt, ...) {
   printf("%s:%i: ", file, line);
 
@@ -144,6 +170,7 @@ static void _sdl_die(const char *file, int line, const char *fmt, ...) {
 #define sdl_die(fmt, ...) _sdl_die(__FILE__, __LINE__, fmt, ## __VA_ARGS__)
 
 #define sdl_try(stmt) ((stmt) && (die("%s\n", SDL_GetError()),0))
+#endif
 
 #define gl_ok_or_die _gl_ok_or_die(__FILE__, __LINE__)
 static void _gl_ok_or_die(const char* file, int line) {
@@ -215,6 +242,280 @@ static FILE* mine_fopen(const char *filename, const char *mode) {
 #endif
 }
 
+// creates the directory if it doesn't exist
+static void mine_mkdir(const char *path) {
+#ifdef OS_WINDOWS
+  _mkdir(path);
+#else
+  mkdir(path, 0755);
+#endif
+}
+
+#define MINE_PATH_MAX 512
+
+// where files for this user that we can always make again go, like the mesh cache, creating it if it doesn't exist.
+// Returns false if we don't know where that is
+static bool mine_cache_dir(char out[MINE_PATH_MAX]) {
+  char base[MINE_PATH_MAX];
+#ifdef OS_WINDOWS
+  const DWORD n = GetEnvironmentVariableA("LOCALAPPDATA", base, sizeof(base));
+  if (!n || n >= sizeof(base))
+    return false;
+#else
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  if (xdg && *xdg)
+    snprintf(base, sizeof(base), "%s", xdg);
+  else if (home && *home)
+    snprintf(base, sizeof(base), "%s/.cache", home);
+  else
+    return false;
+#endif
+  mine_mkdir(base);
+  if (snprintf(out, MINE_PATH_MAX, "%s/mineclone", base) >= MINE_PATH_MAX)
+    return false;
+  mine_mkdir(out);
+  return true;
+}
+
+// a file in a directory, see mine_list_files
+struct FileInfo {
+  char name[64]; // files with longer names are skipped
+  u64 size;
+  u64 modified; // only good for comparing with other files
+};
+
+// adds the files in dir to files. Returns false if the directory couldn't be read
+static bool mine_list_files(const char *dir, Array<FileInfo> &files) {
+#ifdef OS_WINDOWS
+  char pattern[MINE_PATH_MAX];
+  snprintf(pattern, sizeof(pattern), "%s/*", dir);
+  WIN32_FIND_DATAA data;
+  HANDLE h = FindFirstFileA(pattern, &data);
+  if (h == INVALID_HANDLE_VALUE)
+    return false;
+  do {
+    const size_t len = strlen(data.cFileName);
+    if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || len >= sizeof(FileInfo::name))
+      continue;
+    FileInfo f = {};
+    memcpy(f.name, data.cFileName, len + 1);
+    f.size = (u64)data.nFileSizeHigh << 32 | data.nFileSizeLow;
+    f.modified = (u64)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+    array_push(files, f);
+  } while (FindNextFileA(h, &data));
+  FindClose(h);
+  return true;
+#else
+  DIR *d = opendir(dir);
+  if (!d)
+    return false;
+  while (struct dirent *e = readdir(d)) {
+    const size_t len = strlen(e->d_name);
+    char path[MINE_PATH_MAX];
+    struct stat st;
+    if (len >= sizeof(FileInfo::name) || snprintf(path, sizeof(path), "%s/%s", dir, e->d_name) >= (int)sizeof(path) ||
+        stat(path, &st) || !S_ISREG(st.st_mode))
+      continue;
+    FileInfo f = {};
+    memcpy(f.name, e->d_name, len + 1);
+    f.size = (u64)st.st_size;
+    f.modified = (u64)st.st_mtime;
+    array_push(files, f);
+  }
+  closedir(d);
+  return true;
+#endif
+}
+
+// sets the modification time of a file to now
+static void mine_touch(const char *path) {
+#ifdef OS_WINDOWS
+  _utime(path, NULL);
+#else
+  utime(path, NULL);
+#endif
+}
+
+// moves from to to, replacing what was there, so that nobody can see half a file at to. Returns false if it failed
+static bool mine_rename_replace(const char *from, const char *to) {
+#ifdef OS_WINDOWS
+  return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  return rename(from, to) == 0;
+#endif
+}
+
+static unsigned int mine_process_id() {
+#ifdef OS_WINDOWS
+  return (unsigned int)GetCurrentProcessId();
+#else
+  return (unsigned int)getpid();
+#endif
+}
+
+// the most memory the process has had at once, in bytes, or 0 if we couldn't find out
+static u64 mine_peak_memory() {
+#ifdef OS_WINDOWS
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return 0;
+  return counters.PeakWorkingSetSize;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage))
+    return 0;
+  #ifdef __APPLE__
+  return (u64)usage.ru_maxrss;
+  #else
+  return (u64)usage.ru_maxrss * 1024;
+  #endif
+#endif
+}
+
+// @threads
+// Atomics, spin locks, semaphores, threads and timers that work like the SDL ones, for the code that the benchmarks run
+// (world generation, the block loader, meshing and the tasks), so that they build without SDL (see BENCH_ONLY)
+
+// an int that any thread can read and write
+struct AtomicInt {
+  int value;
+};
+
+static int atomic_get(AtomicInt *a) {
+#ifdef OS_WINDOWS
+  const int v = *(volatile int*)&a->value;
+  _ReadWriteBarrier();
+  return v;
+#else
+  return __atomic_load_n(&a->value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// returns the value before
+static int atomic_set(AtomicInt *a, int v) {
+#ifdef OS_WINDOWS
+  return (int)_InterlockedExchange((volatile long*)&a->value, v);
+#else
+  return __atomic_exchange_n(&a->value, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// returns the value before
+static int atomic_add(AtomicInt *a, int v) {
+#ifdef OS_WINDOWS
+  return (int)_InterlockedExchangeAdd((volatile long*)&a->value, v);
+#else
+  return __atomic_fetch_add(&a->value, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// sets it to v if it is expected, and returns true if it was
+static bool atomic_cas(AtomicInt *a, int expected, int v) {
+#ifdef OS_WINDOWS
+  return _InterlockedCompareExchange((volatile long*)&a->value, v, expected) == expected;
+#else
+  return __atomic_compare_exchange_n(&a->value, &expected, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static void atomic_inc(AtomicInt *a) {
+  atomic_add(a, 1);
+}
+
+// returns true if it is 0 now
+static bool atomic_dec(AtomicInt *a) {
+  return atomic_add(a, -1) == 1;
+}
+
+static void memory_barrier_acquire() {
+  std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+static void memory_barrier_release() {
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+// 0 when it's unlocked
+typedef AtomicInt SpinLock;
+
+static void spin_lock(SpinLock *lock) {
+  // give the thread that holds it a chance to run, in case it's waiting for our cpu
+  for (int i = 0; !atomic_cas(lock, 0, 1); ++i)
+    if (i >= 32)
+      std::this_thread::yield();
+}
+
+static void spin_unlock(SpinLock *lock) {
+  atomic_set(lock, 0);
+}
+
+struct Semaphore {
+  std::mutex mutex;
+  std::condition_variable posted;
+  int count;
+};
+
+static Semaphore* semaphore_create() {
+  Semaphore *s = new Semaphore;
+  s->count = 0;
+  return s;
+}
+
+static void semaphore_destroy(Semaphore *s) {
+  delete s;
+}
+
+static void semaphore_post(Semaphore *s) {
+  {
+    std::lock_guard<std::mutex> lock(s->mutex);
+    ++s->count;
+  }
+  s->posted.notify_one();
+}
+
+static void semaphore_wait(Semaphore *s) {
+  std::unique_lock<std::mutex> lock(s->mutex);
+  while (!s->count)
+    s->posted.wait(lock);
+  --s->count;
+}
+
+typedef int (*ThreadFunction)(void *data);
+
+// never fails, the standard library throws instead
+static std::thread* thread_create(ThreadFunction f, void *data) {
+  return new std::thread(f, data);
+}
+
+static void thread_wait(std::thread *t) {
+  t->join();
+  delete t;
+}
+
+// at least 1
+static int mine_cpu_count() {
+  const int n = (int)std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+static void mine_yield() {
+  std::this_thread::yield();
+}
+
+static void mine_sleep_ms(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+// a counter for timing, that goes up mine_performance_frequency() times a second
+static u64 mine_performance_counter() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static u64 mine_performance_frequency() {
+  return 1000000000ull;
+}
+
 // @math
 
 #define sign(x) ((x) < 0.0f ? -1.0f : 1.0f)
@@ -259,6 +560,11 @@ static bool is_invalid(Block b) {
   return b.x == INT_MIN;
 }
 
+struct v1 {
+  static const int DIMENSION = 1;
+  float x;
+};
+
 struct v2 {
   static const int DIMENSION = 2;
   float x,y;
@@ -886,14 +1192,24 @@ static m4 camera_viewortho_matrix(const Camera *camera, v3 pos, float width, flo
 }
 
 
+// the weight of a transparent fragment for weighted blended order-independent transparency
+// (http://jcgt.org/published/0002/02/09/, equation 9), d being the distance to the camera. Closer surfaces count more.
+// Shared by all shaders that draw to the transparency targets, see render_transparent_blocks
+#define TRANSPARENCY_WEIGHT_GLSL \
+  "float transparency_weight(float a, float d) {\n" \
+  "  return a * clamp(0.03f / (1e-5f + pow(d / 200.0f, 4.0f)), 1e-2f, 3e3f);\n" \
+  "}\n"
+
 // @world_object_vertex_shader
 static const char *world_object_vertex_shader = R"VSHADER(
   #version 330 core
 
   // in
-  layout(location = 0) in vec3 pos;
+  layout(location = 0) in vec3 in_pos;
   layout(location = 1) in vec2 tpos;
-  layout(location = 2) in vec3 normal;
+  layout(location = 2) in vec3 in_normal;
+  layout(location = 3) in float occlusion;
+  layout(location = 4) in mat4 instance_model; // transposed, see VertexBuffer::enable_instances
 
   // out
   out vec2 f_tpos;
@@ -914,8 +1230,33 @@ static const char *world_object_vertex_shader = R"VSHADER(
   uniform vec3 u_skylight_color;
   uniform mat4 u_shadowmap_viewprojection;
   uniform samplerCube u_skybox; // so we know what color the fog should be!
+  uniform bool u_instanced; // place the vertices with instance_model, see VoxelModel
+  uniform vec4 u_clip; // (x, y, r, chunk size): only draw in chunks that are all within r of (x,y), so full resolution blocks don't overlap the lod chunks (see lod_hole_contains)
+  uniform vec4 u_lod_clip; // (x, y, r, chunk size): don't draw in chunks whose middle is closer than r to (x,y), so far terrain doesn't overlap the lod chunks
+
+  // how much darker a fully occluded corner is
+  const float AO_STRENGTH = 0.5f;
+
+  // A point inside the face of this vertex, half a block in from the corner, so all corners of a face agree on which
+  // chunk it is in when they are on a chunk border. Faces are quads from box_face_vertices, drawn with the quad element
+  // buffer, so the corner is gl_VertexID % 4. Corner 1 is corner 0 moved along cross(up, normal), and corner 2 is corner 1 moved up,
+  // where up is z for side faces and y for top and bottom faces
+  vec3 point_in_face(vec3 pos, vec3 normal) {
+    int corner = gl_VertexID & 3;
+    vec3 v = abs(normal.z) > 0.5 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, 1.0);
+    vec3 u = cross(v, normal);
+    float du = (corner == 1 || corner == 2) ? -0.5 : 0.5;
+    float dv = corner >= 2 ? -0.5 : 0.5;
+    return pos + du*u + dv*v - 0.5*normal;
+  }
 
   void main() {
+    vec3 pos = in_pos;
+    vec3 normal = in_normal;
+    if (u_instanced) {
+      pos = (vec4(pos, 1.0f) * instance_model).xyz;
+      normal = normalize((vec4(normal, 0.0f) * instance_model).xyz);
+    }
 
     // calculate where the distance lies between fog_near and fog_far
     vec3 dp = pos - u_camerapos;
@@ -929,15 +1270,24 @@ static const char *world_object_vertex_shader = R"VSHADER(
     }
 
     // calculate lighting
-    f_ambient = vec3(u_ambient);
+    float ao = 1.0f - AO_STRENGTH*occlusion;
+    f_ambient = vec3(u_ambient) * ao;
     f_diffuse = vec3(0.0f);
-    f_diffuse += u_skylight_color * max(dot(-u_skylight_dir, normal), 0.0f);
+    f_diffuse += u_skylight_color * max(dot(-u_skylight_dir, normal), 0.0f) * ao;
 
     gl_Position = u_viewprojection * vec4(pos, 1.0f);
     f_shadowmap_pos = u_shadowmap_viewprojection * vec4(pos, 1.0f);
     f_tpos = tpos;
     f_normal = normal;
     f_position = pos - u_camerapos;
+
+    // clip away whole faces instead of discarding fragments, so the opaque blocks keep early depth testing.
+    // gl_ClipDistance is interpolated, so it has to be the same for all corners of a face
+    vec2 p = point_in_face(pos, normal).xy;
+    vec2 chunk = floor(p / u_clip.w) * u_clip.w;
+    vec2 farthest = max(u_clip.xy - chunk, chunk + u_clip.w - u_clip.xy);
+    gl_ClipDistance[0] = dot(farthest, farthest) > u_clip.z*u_clip.z ? -1.0 : 1.0;
+    gl_ClipDistance[1] = u_lod_clip.z > 0.0 && distance((floor(p / u_lod_clip.w) + 0.5) * u_lod_clip.w, u_lod_clip.xy) < u_lod_clip.z ? -1.0 : 1.0;
   }
   )VSHADER";
 
@@ -962,6 +1312,11 @@ static const char *world_object_fragment_shader = R"FSHADER(
   // uniform
   uniform sampler2D u_texture;
   uniform sampler2D u_shadowmap;
+  uniform bool u_transparent; // draw to the transparency targets instead of the gbuffer, see render_transparent_blocks
+
+)FSHADER"
+  TRANSPARENCY_WEIGHT_GLSL
+R"FSHADER(
 
   float calc_shadow(vec4 pos) {
     // perspective divide
@@ -1006,6 +1361,17 @@ static const char *world_object_fragment_shader = R"FSHADER(
     // blend with fog
     c = c*(1-f_fog.w) + f_fog.xyz*f_fog.w;
 
+    // weighted blended order-independent transparency.
+    // location 0 sums up the weighted colors in rgb and multiplies the revealage (how much of what's behind shows through) in alpha,
+    // and location 1 sums up the weights
+    if (u_transparent) {
+      float a = tex.w;
+      float w = transparency_weight(a, length(f_position));
+      g_color = vec4(c * a * w, a);
+      g_normal = vec4(a * w);
+      return;
+    }
+
     g_color = vec4(c, tex.w);
     g_normal = vec4(f_normal, 1);
     g_position = vec4(f_position, 1.0);
@@ -1139,6 +1505,120 @@ R"FSHADER(
   }
 )FSHADER";
 
+// @transparency_vertex_shader
+static const char *transparency_vertex_shader = ui_vertex_shader;
+
+// @transparency_fragment_shader
+// puts the transparent surfaces on top of the gbuffer color, see render_transparent_blocks
+static const char *transparency_fragment_shader = R"FSHADER(
+  #version 330 core
+
+  // in
+  in vec2 f_tpos;
+
+  // out
+  out vec4 f_color;
+
+  // uniform
+  uniform sampler2D u_accum;
+  uniform sampler2D u_weight;
+
+  void main() {
+    vec4 accum = texture(u_accum, f_tpos);
+    float revealage = accum.a;
+    // nothing transparent here
+    if (revealage >= 1.0f)
+      discard;
+
+    // the weighted average color of all surfaces, blended over the gbuffer by how much they cover
+    float weight = max(texture(u_weight, f_tpos).r, 1e-5f);
+    f_color = vec4(accum.rgb / weight, 1.0f - revealage);
+  }
+)FSHADER";
+
+// @cloud_vertex_shader
+// one big quad at cloud height that follows the camera, see render_clouds
+static const char *cloud_vertex_shader = R"VSHADER(
+  #version 330 core
+
+  // in
+  layout(location = 0) in vec2 pos;
+
+  // out
+  out vec2 f_world_xy;
+  out vec3 f_position;
+
+  // uniform
+  uniform mat4 u_viewprojection;
+  uniform vec3 u_camerapos;
+  uniform float u_size; // half the width of the quad
+  uniform float u_height;
+
+  void main() {
+    vec3 p = vec3(u_camerapos.xy + pos*u_size, u_height);
+    gl_Position = u_viewprojection * vec4(p, 1.0f);
+    f_world_xy = p.xy;
+    f_position = p - u_camerapos;
+  }
+  )VSHADER";
+
+// @cloud_fragment_shader
+static const char *cloud_fragment_shader = R"FSHADER(
+  #version 330 core
+
+  // in
+  in vec2 f_world_xy;
+  in vec3 f_position;
+
+  // out
+  layout(location = 0) out vec4 g_accum;
+  layout(location = 1) out vec4 g_weight;
+
+  // uniform
+  uniform float u_size;
+  uniform vec2 u_offset; // how far the wind has moved the clouds
+  uniform vec3 u_ambient;
+  uniform vec3 u_skylight_color;
+  uniform vec2 u_distance_range; // only draw the clouds this far away, see render_clouds
+
+)FSHADER"
+  TRANSPARENCY_WEIGHT_GLSL
+R"FSHADER(
+
+  float hash(vec2 p) {
+    return fract(sin(dot(p, vec2(127.1f, 311.7f))) * 43758.5453f);
+  }
+
+  // value noise in [0,1]
+  float noise(vec2 p) {
+    vec2 i = floor(p);
+    vec2 f = fract(p);
+    f = f*f*(3.0f - 2.0f*f);
+    return mix(mix(hash(i), hash(i + vec2(1, 0)), f.x),
+               mix(hash(i + vec2(0, 1)), hash(i + vec2(1, 1)), f.x), f.y);
+  }
+
+  void main() {
+    float d = length(f_position);
+    if (d < u_distance_range.x || d >= u_distance_range.y)
+      discard;
+
+    // the clouds are made of whole blocks, like everything else
+    vec2 p = floor(f_world_xy + u_offset) * 0.05f;
+    float n = noise(p)*0.5f + noise(p*2.0f)*0.3f + noise(p*4.0f)*0.2f;
+    float a = smoothstep(0.55f, 0.6f, n) * 0.8f;
+    // fade out before the edge of the quad
+    a *= 1.0f - smoothstep(0.6f*u_size, u_size, length(f_position.xy));
+    if (a <= 0.0f)
+      discard;
+
+    vec3 c = min(u_ambient + u_skylight_color, vec3(1.0f));
+    float w = transparency_weight(a, length(f_position));
+    g_accum = vec4(c * a * w, a);
+    g_weight = vec4(a * w);
+  }
+)FSHADER";
+
 // @text_vertex_shader
 static const char *text_vertex_shader = R"VSHADER(
   #version 330 core
@@ -1490,17 +1970,80 @@ private:
 
 };
 
+// how far out we load and draw full resolution blocks. It can be changed at runtime, see set_view_distance
+#define DEFAULT_VIEW_DISTANCE 128
+#define MIN_VIEW_DISTANCE 32
+#define MAX_VIEW_DISTANCE 256
+#define VIEW_DISTANCE_STEP 32
+// how far outside of the load area sections have to be before they are unloaded, see @residency
+#define DEFAULT_UNLOAD_MARGIN 16
+// how many sections that left the area around the player we keep loaded anyway, see @residency
+#define MAX_RETAINED_SECTIONS 512
+
 // how many blocks we keep in caches and stuff.
-// The reason these are less than NUM_VISIBLE_BLOCKS is to give room for the lazy block loader
-// to take its time :)
+// Along x and y the range around the player is twice the view distance plus the unload margin on each side, and the
+// margin is at most half the view distance (see unload_margin). Along z it's NUM_VISIBLE_BLOCKS_z plus the margin on each side. The caches are four times the view distance (rounded up to a power of two,
+// see block_cache_width), so they follow the view distance and are picked at runtime.
+// The reason the range is less than the caches is to give room for the lazy block loader to take its time :)
 static const int
-  NUM_VISIBLE_BLOCKS_x = 256,
-  NUM_VISIBLE_BLOCKS_y = 256,
-  NUM_VISIBLE_BLOCKS_z = 256;
+  NUM_VISIBLE_BLOCKS_z = 256,
+  NUM_BLOCKS_z = (NUM_VISIBLE_BLOCKS_z*2),
+  MAX_NUM_BLOCKS_xy = (MAX_VIEW_DISTANCE*4);
+
+// the block caches are divided into sections of SECTION_SIZE^3 blocks, which is what we keep
+// bookkeeping for, like where the faces of each block are in the vertex arrays
+#define SECTION_SIZE_BITS 4
+#define SECTION_SIZE (1 << SECTION_SIZE_BITS)
+#define SECTION_NUM_BLOCKS (SECTION_SIZE*SECTION_SIZE*SECTION_SIZE)
+#define SECTION_NUM_FACES (SECTION_NUM_BLOCKS*DIRECTION_MAX)
 static const int
-  NUM_BLOCKS_x = (NUM_VISIBLE_BLOCKS_x*2),
-  NUM_BLOCKS_y = (NUM_VISIBLE_BLOCKS_y*2),
-  NUM_BLOCKS_z = (NUM_VISIBLE_BLOCKS_z*2);
+  NUM_SECTIONS_z = NUM_BLOCKS_z/SECTION_SIZE,
+  MAX_NUM_SECTIONS_xy = MAX_NUM_BLOCKS_xy/SECTION_SIZE;
+// how many milliseconds per frame we spend rebuilding the faces of blocks that were loaded, see update_remesh
+#define REMESH_BUDGET_MS 2.0f
+
+enum SectionResidency {
+  SECTION_UNLOADED,
+  SECTION_LOADED, // in the area that is kept loaded around the player
+  SECTION_RETAINED, // left that area, but is kept anyway in case the player comes back
+};
+
+struct Section {
+  // where the faces of the blocks in this section are in the vertex arrays, indexed by section_face_index.
+  // 0 means that the face is not shown, otherwise it's the face position + 1.
+  // Allocated when the first face of the section is shown, and kept until the section is unloaded (see update_remesh),
+  // so that hiding and showing the only faces of a section over and over doesn't allocate every time
+  int *face_slots;
+  int num_faces;
+
+  // remesh bookkeeping, only touched by the main thread (see @remesh).
+  // One bit per block (indexed by section_block_index) for the blocks whose faces need to be rebuilt.
+  // Allocated when the section is queued for remeshing, and freed when it's done
+  u64 *dirty_blocks;
+  // the player changed something in here, so remesh it before anything else and regardless of the frame budget
+  bool remesh_edit;
+
+  // the last call to update_block_loader_jobs that saw a block loader job for this section, and the first job it saw,
+  // or -1 if later jobs for the section can't be merged into it any more. Main thread only
+  u32 loader_jobs_pass;
+  int loader_first_job;
+
+  // @residency, main thread only. Which section of the world is in this part of the block cache, or will be once the
+  // block loader has done its jobs, since sections a cache width apart share it
+  Block resident;
+  u8 residency; // a SectionResidency
+  // the section was queued for remeshing while it was retained, and might have lost faces if it was outside of the
+  // range then, so it is remeshed when it's loaded again
+  bool retained_remesh;
+  // its blocks were loaded the last time it was remeshed, so it shows what it should. Main thread only, see @startup
+  bool meshed;
+
+  // 1 while the block loader has a command for this part of the block cache, see update_block_loader_jobs
+  AtomicInt loader_command_queued;
+
+  // odd while someone writes to the blocks of this section in the block cache, see @seqlock
+  AtomicInt version;
+};
 
 struct BlockDiff {
   Block block;
@@ -1533,8 +2076,12 @@ enum Key {
   KEY_FLYUP,
   KEY_FLYDOWN,
   KEY_ESCAPE,
+  KEY_VIEW_FARTHER,
+  KEY_VIEW_NEARER,
+  KEY_TELEPORT,
   KEY_MAX,
 };
+#ifndef BENCH_ONLY
 Key keymapping(SDL_Keycode k) {
   switch (k) {
     case SDLK_UP: return KEY_FORWARD;
@@ -1546,10 +2093,14 @@ Key keymapping(SDL_Keycode k) {
     case SDLK_w: return KEY_FLYUP;
     case SDLK_s: return KEY_FLYDOWN;
     case SDLK_ESCAPE: return KEY_ESCAPE;
+    case SDLK_PAGEUP: return KEY_VIEW_FARTHER;
+    case SDLK_PAGEDOWN: return KEY_VIEW_NEARER;
+    case SDLK_t: return KEY_TELEPORT;
     default: return KEY_NULL;
   }
   return KEY_NULL;
 }
+#endif
 
 struct Glyph {
   unsigned short x0, y0, x1, y1; /* Position in image */
@@ -1578,6 +2129,40 @@ struct BlockLoaderCommand {
   BlockRange range;
 };
 
+// a histogram of how long a lock was waited for or held, so we can get percentiles, see lock_times_add.
+// Only one thread adds to it
+struct LockTimes {
+  #define LOCK_TIMES_BUCKETS 128
+  AtomicInt counts[LOCK_TIMES_BUCKETS]; // bucket i has the times from 2^(i/4) to 2^((i+1)/4) nanoseconds
+  AtomicInt max_ns;
+};
+
+// @tasks, see push_task
+typedef void (*TaskFunction)(void *data, int begin, int end);
+
+struct TaskCounter;
+struct Task {
+  TaskFunction function;
+  void *data;
+  int begin, end; // which part of the work this task does, like the items of a parallel_for
+  TaskCounter *counter; // counted down when the task is done, or NULL
+};
+
+// how many tasks that count it are not done yet, see wait_for_tasks
+struct TaskCounter {
+  AtomicInt tasks;
+  SpinLock lock;
+  Array<Task> waiting; // tasks that were pushed to run after these, use lock
+};
+
+// the tasks of a thread. They are pushed and popped at the back, and stolen from the front, starting at top
+struct TaskDeque {
+  SpinLock lock;
+  Array<Task> tasks;
+  int top;
+  char padding[64]; // so that threads that take the locks of deques next to each other don't share a cache line
+};
+
 static int gl_format_to_num_channels(GLenum format) {
   switch (format) {
     case GL_RED:
@@ -1627,27 +2212,68 @@ struct WorldObjectVertex {
   v3 pos;
   v2 tex;
   v3 normal;
+  v1 occlusion; // ambient occlusion, 0 is none and 1 is a corner with blocks on both sides (see @ao)
 };
 VertexDataSpec world_object_vertex_spec[] = {
   VERTEXDATA_FLOAT(WorldObjectVertex, pos),
   VERTEXDATA_FLOAT(WorldObjectVertex, tex),
-  VERTEXDATA_FLOAT(WorldObjectVertex, normal)
+  VERTEXDATA_FLOAT(WorldObjectVertex, normal),
+  VERTEXDATA_FLOAT(WorldObjectVertex, occlusion)
 };
 
+// All our quads (4 vertices each, drawn as v, v+1, v+2, v, v+2, v+3) are drawn with the same static element buffer,
+// so nobody has to build or upload elements for them. It has 16 bit indices, so it covers MAX_QUADS_PER_DRAW quads,
+// and more quads than that are drawn in batches with a base vertex (see RenderPipeline::render)
+#define MAX_QUADS_PER_DRAW (65536/4)
+static GLuint get_quad_element_buffer() {
+  static GLuint ebo;
+  if (ebo)
+    return ebo;
+
+  u16 *elements = (u16*)malloc(MAX_QUADS_PER_DRAW * 6 * sizeof(*elements));
+  if (!elements)
+    die("Failed to allocate quad elements");
+  for (int i = 0; i < MAX_QUADS_PER_DRAW; ++i) {
+    u16 *e = &elements[i*6];
+    *e++ = (u16)(i*4);
+    *e++ = (u16)(i*4+1);
+    *e++ = (u16)(i*4+2);
+    *e++ = (u16)(i*4);
+    *e++ = (u16)(i*4+2);
+    *e++ = (u16)(i*4+3);
+  }
+
+  glGenBuffers(1, &ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, MAX_QUADS_PER_DRAW * 6 * sizeof(*elements), elements, GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  free(elements);
+  gl_ok_or_die;
+  return ebo;
+}
+
 struct VertexBuffer {
   GLuint vao;
   GLuint vbo;
   GLuint ebo;
   int num_vertices;
   int num_elements;
+  int vbo_capacity; // how many vertices there is room for in the vbo
   VertexDataSpec *spec;
   int num_specs;
+  // vertices are quads, drawn with the shared quad element buffer, see create_quads
+  bool quads;
+  // if set, the vertices are drawn once per model matrix in here, see enable_instances
+  GLuint instance_vbo;
+  int num_instances;
 
   bool has_element_buffer() const {
     return ebo;
   }
 
   int num_items() const {
+    if (this->quads)
+      return this->num_vertices/4*6;
     if (this->ebo)
       return this->num_elements;
     else
@@ -1668,6 +2294,44 @@ struct VertexBuffer {
     glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
     glBufferData(GL_ARRAY_BUFFER, num_vertices*sizeof(V), vertices, usage);
     this->num_vertices = num_vertices;
+    this->vbo_capacity = num_vertices;
+  }
+
+  // make room for capacity vertices, without sending any. Use update_vbo_data to fill it up
+  template<class V>
+  void alloc_vbo(int capacity, GLenum usage = GL_DYNAMIC_DRAW) {
+    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+    glBufferData(GL_ARRAY_BUFFER, capacity*sizeof(V), 0, usage);
+    this->num_vertices = 0;
+    this->vbo_capacity = capacity;
+  }
+
+  // send vertices [first, first+num) to the same place in the vbo
+  template<class V>
+  void update_vbo_data(V vertices[], int first, int num) {
+    glBindBuffer(GL_ARRAY_BUFFER, this->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(V), num*sizeof(V), vertices + first);
+  }
+
+  // draw the vertices once per instance, each with its own model matrix.
+  // The matrix takes the 4 attribute locations after the vertex data, and since m4 is row major, the shader sees it transposed
+  void enable_instances() {
+    glGenBuffers(1, &this->instance_vbo);
+    glBindVertexArray(this->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, this->instance_vbo);
+    for (int i = 0; i < 4; ++i) {
+      glEnableVertexAttribArray(this->num_specs + i);
+      glVertexAttribPointer(this->num_specs + i, 4, GL_FLOAT, GL_FALSE, sizeof(m4), (GLvoid*)(uintptr_t)(i*4*sizeof(float)));
+      glVertexAttribDivisor(this->num_specs + i, 1);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  void set_instance_data(m4 models[], int num_models) {
+    glBindBuffer(GL_ARRAY_BUFFER, this->instance_vbo);
+    glBufferData(GL_ARRAY_BUFFER, num_models*sizeof(m4), models, GL_STREAM_DRAW);
+    this->num_instances = num_models;
   }
 
   void set_ebo_data(void *elements, int num_elements, GLenum usage = GL_DYNAMIC_DRAW) {
@@ -1708,14 +2372,10 @@ struct VertexBuffer {
     for (int i = 0; i < num_info; ++i) {
       VertexDataSpec v = info[i];
       glEnableVertexAttribArray(i);
-      if (v.as_integer) {
+      if (v.as_integer)
         glVertexAttribIPointer(i, v.count, v.type, v.stride, (GLvoid*)(uintptr_t)v.offset);
-        printf("ipointer: %i %i %i %i %i\n", i, v.count, v.type, v.stride, v.offset);
-      }
-      else {
+      else
         glVertexAttribPointer(i, v.count, v.type, v.normalize, v.stride, (GLvoid*)(uintptr_t)v.offset);
-        printf("pointer:  %i %i %i %i %i\n", i, v.count, v.type, v.stride, v.offset);
-      }
     }
 
     glBindVertexArray(0);
@@ -1724,6 +2384,19 @@ struct VertexBuffer {
       glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     return vb;
   }
+
+  // a vertex buffer of quads, that only needs vertex data. See get_quad_element_buffer
+  static VertexBuffer create_quads(VertexDataSpec info[], int num_info) {
+    const GLuint ebo = get_quad_element_buffer();
+    VertexBuffer vb = create(info, num_info, false);
+    vb.quads = true;
+    vb.ebo = ebo;
+    glBindVertexArray(vb.vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    return vb;
+  }
 };
 
 struct Shader {
@@ -1983,6 +2656,9 @@ enum RenderFlag {
   RENDERFLAG_BLEND           = 1 << 1,
   RENDERFLAG_CULL_FRONT_FACE = 1 << 2,
   RENDERFLAG_CULL_BACK_FACE  = 1 << 3,
+  RENDERFLAG_BLEND_WEIGHTED  = 1 << 4, // adds up color and multiplies alpha, for weighted blended transparency (see render_transparent_blocks)
+  RENDERFLAG_NO_DEPTH_WRITE  = 1 << 5,
+  RENDERFLAG_CLIP            = 1 << 6, // the shader writes gl_ClipDistance[0] and [1], see set_world_clip
 };
 struct RenderPipeline {
   Shader *shader;
@@ -2016,16 +2692,31 @@ struct RenderPipeline {
       glEnable(GL_DEPTH_TEST);
     else
       glDisable(GL_DEPTH_TEST);
+    glDepthMask((this->render_flags & RENDERFLAG_NO_DEPTH_WRITE) ? GL_FALSE : GL_TRUE);
 
     // blend
     if (this->render_flags & RENDERFLAG_BLEND) {
       glEnable(GL_BLEND);
       glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
+    else if (this->render_flags & RENDERFLAG_BLEND_WEIGHTED) {
+      glEnable(GL_BLEND);
+      glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
     else {
       glDisable(GL_BLEND);
     }
 
+    // clip
+    if (this->render_flags & RENDERFLAG_CLIP) {
+      glEnable(GL_CLIP_DISTANCE0);
+      glEnable(GL_CLIP_DISTANCE1);
+    }
+    else {
+      glDisable(GL_CLIP_DISTANCE0);
+      glDisable(GL_CLIP_DISTANCE1);
+    }
+
     // cull
     if (this->render_flags & (RENDERFLAG_CULL_FRONT_FACE | RENDERFLAG_CULL_BACK_FACE)) {
       glEnable(GL_CULL_FACE);
@@ -2040,7 +2731,16 @@ struct RenderPipeline {
     // bind VAO and draw
     this->vb->bind();
     gl_ok_or_die;
-    if (this->vb->has_element_buffer())
+    if (this->vb->quads && this->vb->instance_vbo) {
+      for (int first = 0; first < num_vertices; first += MAX_QUADS_PER_DRAW*6)
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, min(num_vertices - first, MAX_QUADS_PER_DRAW*6), GL_UNSIGNED_SHORT, 0, this->vb->num_instances, first/6*4);
+    }
+    else if (this->vb->quads) {
+      // the quad element buffer only covers MAX_QUADS_PER_DRAW quads, so draw the rest in batches
+      for (int first = 0; first < num_vertices; first += MAX_QUADS_PER_DRAW*6)
+        glDrawElementsBaseVertex(GL_TRIANGLES, min(num_vertices - first, MAX_QUADS_PER_DRAW*6), GL_UNSIGNED_SHORT, 0, first/6*4);
+    }
+    else if (this->vb->has_element_buffer())
       glDrawElements(GL_TRIANGLES, num_vertices, GL_UNSIGNED_INT, 0);
     else
       glDrawArrays(GL_TRIANGLES, 0, num_vertices);
@@ -2052,17 +2752,117 @@ struct RenderPipeline {
   }
 };
 
+// @voxel_model
+// A model made of voxels, like the tools in tools.bmp.
+// Only the faces between a voxel and air are meshed, and faces next to each other that point the same way are merged
+// into bigger quads (greedy meshing), so a model costs vertices for its outline instead of 24 per voxel.
+// Models are built once per file and then cached, see voxel_model_get. All instances of a model that are pushed
+// during a frame are drawn with one draw call, see push_voxel_model and render_voxel_models
+#define MAX_VOXEL_MODELS 16
+struct VoxelModel {
+  char filename[64];
+  VertexBuffer vb;
+  Array<m4> instances; // where to draw the model this frame
+};
+
+
+
+// the faces of a bucket of blocks (see below).
+// Every face is a quad of 4 vertices, so the face in slot i starts at vertex i*4. We draw them with the shared quad element buffer.
+// Hidden faces leave holes, which are reused by new faces or filled up by compact_block_mesh
+//
+// Faces are put in buckets, by whether they are transparent, which direction they face, and which slab of sections along the axis of that direction
+// they are in. All faces in a bucket face the same way from planes at most a section apart, so we can skip whole buckets that face away from the camera
+// before the gpu sees them (see block_mesh_bucket_is_visible). Each bucket is its own BlockMesh with its own vertex buffer
+#define BLOCK_MESH_PAGE_FACES 256
+// there are enough slabs for the biggest block cache, and along z, or along x and y with smaller caches, some are never used
+#define NUM_BLOCK_MESH_SLABS MAX_NUM_SECTIONS_xy
+STATIC_ASSERT(MAX_NUM_SECTIONS_xy >= NUM_SECTIONS_z, block_mesh_slabs_cover_all_axes);
+struct BlockMesh {
+  Array<WorldObjectVertex> vertices;
+  // which block face is in each slot (see block_face_key), or BLOCK_FACE_KEY_NONE if it's a hole
+  Array<u32> face_keys;
+  // slots that have been freed. Can contain stale entries for slots that have since been reused or
+  // compacted away, so always check face_keys before using one
+  Array<int> free_faces;
+  int num_holes;
+  // flag so we know if we should resend the vertex data to the gl buffer at the end of the frame
+  bool dirty;
+  // which pages of BLOCK_MESH_PAGE_FACES faces changed since the last upload, so we only resend those (see upload_block_mesh)
+  Array<u8> dirty_pages;
+};
+
+// @lod
+// Far away terrain is drawn with lod chunks instead of blocks. A lod chunk is a column of LOD_CHUNK_SIZE x LOD_CHUNK_SIZE blocks,
+// meshed from downsampled blocks, where each cell of a chunk at level l covers (2^l)^3 blocks. Closer chunks get finer levels (see state.lod.level_distances).
+// Full resolution blocks are only drawn in the "hole" of lod chunks that are well inside the loaded block range, and lod chunks everywhere else
+#define LOD_CHUNK_SIZE 32
+#define LOD_MAX_LEVEL 3
+#define LOD_MAX_HEIGHT 128
+#define LOD_GRID_SIZE 64 // lod chunks are kept in a toroidal grid, like the block cache
+#define LOD_HOLE_MARGIN 16 // how far inside the load area the hole has to be, to give the block loader some slack
+#define LOD_MAX_UPLOADS_PER_FRAME 64
+STATIC_ASSERT(LOD_CHUNK_SIZE >> LOD_MAX_LEVEL >= 1, lod_chunk_fits_a_cell);
+
+struct LodChunk {
+  int x, y; // which chunk this is, in chunk coordinates (block/LOD_CHUNK_SIZE)
+  int level; // the level of the mesh in vb, 0 if there is none
+  int wanted_level;
+  VertexBuffer vb;
+  bool has_vb;
+};
+
+struct LodRequest {
+  int x, y, level;
+  float distance;
+};
+
+struct LodResult {
+  int x, y, level;
+  Array<WorldObjectVertex> vertices;
+};
+
+// chunks for the terrain threads to mesh, and the meshes they made, see lod_queue_pop
+struct LodQueue {
+  Array<LodRequest> requests; // nearest first
+  int requests_head;
+  Array<LodResult> results;
+};
 
+// @farterrain
+// Beyond the lod chunks and out to FAR_TERRAIN_DISTANCE, terrain is only a heightmap of columns, made in tiles of FAR_TERRAIN_TILE_SIZE blocks.
+// The columns of a tile at level l are 2^l blocks wide, so tiles use the same chunk, request and queue types as the lod chunks
+#define FAR_TERRAIN_TILE_SIZE 512
+#define FAR_TERRAIN_DISTANCE 4096.0f
+#define FAR_TERRAIN_GRID_SIZE 32 // tiles are kept in a toroidal grid, like the lod chunks
+#define FAR_TERRAIN_NEAR_LEVEL 5
+#define FAR_TERRAIN_FAR_LEVEL 6
+#define FAR_TERRAIN_FAR_LEVEL_DISTANCE 2048.0f // tiles further away than this get FAR_TERRAIN_FAR_LEVEL
+#define FAR_TERRAIN_SKIRT 24 // how far below the neighbouring column the walls of a column go down
+#define TERRAIN_NUM_THREADS 2 // threads meshing lod chunks and far terrain tiles
+// the near columns line up with the lod chunks, so we can hide the ones that are covered by lod chunks (see set_world_clip)
+STATIC_ASSERT((1 << FAR_TERRAIN_NEAR_LEVEL) == LOD_CHUNK_SIZE, far_terrain_columns_line_up_with_lod_chunks);
+STATIC_ASSERT(FAR_TERRAIN_TILE_SIZE >> FAR_TERRAIN_NEAR_LEVEL <= 16, far_terrain_tile_fits);
 
 // cache for world generation stuff that is the same over all Z
 struct WorldXYData {
   int groundlevel;
   int stonelevel;
 };
+
+// Columns state.world.num_blocks_xy blocks apart share an entry, so it remembers which column it is for.
+// Any thread can read and write it, see get_world_xy_cache
+struct WorldXYCacheEntry {
+  AtomicInt version; // 0 if it was never written, odd while it's written, like the versions in @seqlock
+  int x, y;
+  WorldXYData data;
+};
 struct GameState {
   // window stuff
   struct {
+    #ifndef BENCH_ONLY
     SDL_Window *window;
+    #endif
     float screen_ratio;
     int screen_width, screen_height;
     FrameBuffer screen_framebuffer;
@@ -2087,6 +2887,7 @@ struct GameState {
     bool mouse_clicked;
     bool mouse_clicked_right;
     int scrolled; // negative when scrolling down, positive when up
+    bool teleport_key; // the teleport key only works with --teleport-key, see @teleport
   };
 
   // camera stuff
@@ -2106,10 +2907,28 @@ struct GameState {
     v3 diffuse_light;
   };
 
+  // @tasks
+  struct {
+    #define MAX_TASK_WORKERS 64
+    int num_workers; // worker threads. The main thread also runs tasks when it waits for them
+    std::thread *workers[MAX_TASK_WORKERS];
+    TaskDeque deques[MAX_TASK_WORKERS + 1]; // the one of the main thread first, then the ones of the workers
+    Semaphore *wakeup; // posted once for every task pushed to a deque, the workers wait on it
+    AtomicInt quit;
+    AtomicInt num_stolen; // how many tasks were taken from the deque of another thread
+    // what the workers do when they find no task: does one piece of work and returns true, or returns false if there
+    // was none. Threads that wait for tasks never do it, see @tasks
+    bool (*background_work)();
+  } tasks;
+
   // block loader buffers
   struct {
-    // IMPORTANT: use this lock if you want to manipulate blocks from another thread other than the block loader thread
-    SDL_SpinLock lock;
+    // IMPORTANT: use this lock if you want to manipulate blocks from another thread other than the block loader's tasks.
+    // It's a spinlock, so only hold it for a short while, see block_loader_lock
+    SpinLock lock;
+    // how long the block loader's tasks and the main thread waited for lock, and how long they held it
+    LockTimes loader_lock_wait, loader_lock_hold;
+    LockTimes main_lock_wait, main_lock_hold;
 
     struct LoadedBlock {
       BlockType type;
@@ -2117,35 +2936,118 @@ struct GameState {
     };
 
     #define MAX_LOADED_BLOCKS 2048
-    #define MAX_BLOCK_LOADER_COMMANDS 64
-
-    // TODO: only single producer, single consumer at this point.
-    BlockLoaderCommand commands[MAX_BLOCK_LOADER_COMMANDS];
-    int commands_head;
-    int commands_tail;
-    SDL_sem *num_commands;
-    SDL_sem *num_commands_free;
+    #define MAX_BLOCK_LOADER_COMMANDS 4096
+    // how many blocks of jobs we let the block loader have at once, about a frame of work.
+    // The rest wait in jobs, so that they can be reprioritized as the player moves, see update_block_loader_jobs
+    #define BLOCK_LOADER_MAX_QUEUED_BLOCKS (256*SECTION_NUM_BLOCKS)
+
+    // commands for the block loader, a bounded lock-free queue that any thread can push to and pop from, see try_push_block_loader_command
+    struct {
+      AtomicInt sequence;
+      BlockLoaderCommand command;
+    } commands[MAX_BLOCK_LOADER_COMMANDS];
+    AtomicInt commands_head; // where the next command is pushed
+    AtomicInt commands_tail; // where the next command is popped
+    // commands that were pushed and aren't done yet. The task workers pop them as background work (see @tasks),
+    // so that the main thread never runs them while it waits for its own tasks
+    AtomicInt commands_running;
+    AtomicInt blocks_queued; // how many blocks the commands in the queue cover
+    // commands that are not in the queue yet, split up so that no command covers more than one section, in the order
+    // they were pushed. Main thread only, see update_block_loader_jobs
+    Array<BlockLoaderCommand> jobs;
+    // stats
+    AtomicInt max_commands_queued;
+    AtomicInt num_full; // how many pushes found the queue full
+    int num_cancelled; // how many jobs were dropped before they started, since their blocks were no longer wanted
+    int num_coalesced; // how many jobs were merged into an earlier job for the same section
+    // @prefetch. How many blocks the block loader has loaded or unloaded, and for how long at least one of its commands
+    // was running, in microseconds, so we see how fast all of them go together. Use busy_lock. Both wrap around
+    SpinLock busy_lock;
+    int num_running;
+    u64 busy_since; // mine_performance_counter when num_running went from 0 to 1
+    u32 blocks_done;
+    u32 busy_us;
+    float blocks_per_ms; // how fast the block loader goes, from those, or 0 if we don't know yet. Main thread only
+
+    // ranges of blocks that the block loader changed, and whose faces the main thread needs to rebuild. Use remesh_lock
+    SpinLock remesh_lock;
+    Array<BlockRange> remesh_requests;
   } block_loader;
 
+  // @remesh, sections whose faces need to be rebuilt, see update_remesh
+  struct {
+    Array<BlockIndex> queue;
+    Array<BlockRange> requests; // taken from the block loader
+    int sections_this_frame;
+  } remesh;
+
+  // @meshcache
+  struct {
+    bool enabled;
+    char dir[MINE_PATH_MAX - 64]; // leaves room for the names of the entries
+    u64 budget; // in bytes, see mesh_cache_evict
+    int hits, misses, bad_entries;
+
+    // the entries to write and the ones we used, for the writer thread. Use lock for these, see mesh_cache_writer_thread
+    SpinLock lock;
+    Array<u8*> writes; // malloc'd, a MeshCacheHeader and what follows it
+    Array<u64> touched; // hashes of entries that were used
+    u64 pending; // bytes in writes
+    bool writing; // the writer thread is working on what it took out of writes and touched
+    int evicted, dropped;
+    Semaphore *wakeup;
+    std::thread *writer;
+    u64 size; // about how much the entries take up on disk, in bytes. Only the writer thread uses this
+  } mesh_cache;
+
+  // @startup
+  struct {
+    u64 start; // mine_performance_counter when we started, or when the player teleported (see @teleport)
+    bool playable; // the world around the player is there, so they can move
+    bool teleported; // we are waiting for the world after a teleport, not at startup
+  } startup;
+
+  // @lod
+  struct {
+    bool enabled;
+    // chunks closer than level_distances[l-1] blocks are meshed at level l. Nothing is drawn beyond the last one. See set_lod_level_distances
+    float level_distances[LOD_MAX_LEVEL];
+    LodChunk chunks[LOD_GRID_SIZE][LOD_GRID_SIZE];
+    // the chunk the player was in when we last picked levels, and where exactly
+    int center_x, center_y;
+    v3 center_pos;
+    bool needs_update;
+
+    // use lock for this and state.far_terrain.queue
+    SpinLock lock;
+    LodQueue queue;
+    Semaphore *wakeup; // posted when there are new requests for the terrain threads
+  } lod;
+
+  // @farterrain
+  struct {
+    bool enabled;
+    LodChunk tiles[FAR_TERRAIN_GRID_SIZE][FAR_TERRAIN_GRID_SIZE];
+    // the tile the player was in when we last picked levels
+    int center_x, center_y;
+    bool needs_update;
+    LodQueue queue; // use state.lod.lock
+  } far_terrain;
+
   // block graphics data
   struct {
     #define NUM_BLOCK_SIDES_IN_TEXTURE 3 // the number of different textures we have per block. at the moment, it is top,side,bottom
     #define BLOCK_TEXTURE_SIZE 16
 
     Shader world_object_shader;
-    VertexBuffer opaque_block_vb;
     RenderPipeline opaque_block_pipeline;
     Texture block_texture;
 
-    Array<WorldObjectVertex> block_vertices;
-    Array<uint> block_elements;
-    // a list of positions in the vertex array that are free
-    Array<int> free_faces;
-    // flag so we know if we should resend the vertex data to the gl buffer at the end of the frame
-    bool block_vertices_dirty;
+    // the faces of all blocks, in buckets by [transparent][direction][slab], see get_block_mesh
+    BlockMesh block_meshes[2][DIRECTION_MAX][NUM_BLOCK_MESH_SLABS];
+    VertexBuffer block_vbs[2][DIRECTION_MAX][NUM_BLOCK_MESH_SLABS];
 
-    // mapping from block face to the position in the vertex array, to optimize removal of blocks. use get_block_vertex_pos to get 
-    Map<u64, int, 0, UINT32_MAX> block_vertex_pos;
+    // (the mapping from block face to the position in the vertex array lives in state.world.sections, see get_block_face_slot)
 
     // shadowmapping stuff, see https://learnopengl.com/Advanced-Lighting/Shadows/Shadow-Mapping for a great tutorial on shadowmapping
     Shader shadowmap_shader;
@@ -2164,30 +3066,33 @@ struct GameState {
     RenderPipeline post_processing_pipeline;
 
     // same thing as all of the above, but for transparent blocks (since they need to be rendered separately after everything else has rendered in order for them to look correct)
-    VertexBuffer transparent_block_vb;
     RenderPipeline transparent_block_pipeline;
-    Array<WorldObjectVertex> transparent_block_vertices;
-    Array<uint> transparent_block_elements;
-    Array<int> free_transparent_faces;
-    bool transparent_block_vertices_dirty;
+    // transparent blocks are drawn to these targets in any order, and then put on top of the gbuffer color (see render_transparent_blocks)
+    FrameBuffer transparency_framebuffer, transparency_composite_framebuffer;
+    Texture transparency_accum_target, transparency_weight_target;
+    Shader transparency_shader;
+    RenderPipeline transparency_pipeline;
 
     // where in the texture buffer is the water texture. We change the texture every frame to fake moving water
     struct {int x,y,w,h;} water_texture_pos;
     u8 water_texture_buffer[BLOCK_TEXTURE_SIZE*BLOCK_TEXTURE_SIZE*NUM_BLOCK_SIDES_IN_TEXTURE*4]; // 4 because of rgba
   };
 
-  // tool graphics data
+  // voxel model graphics data
   struct {
+    VoxelModel voxel_models[MAX_VOXEL_MODELS];
+    int num_voxel_models;
+    RenderPipeline voxel_model_pipeline;
+
     m4 controller_pose;
-    VertexBuffer tool_vb;
-    RenderPipeline tool_pipeline;
+    VoxelModel *tool_model;
+    float tool_bob; // how far the tool is into bobbing up and down, in radians, see update_tool
   };
 
   // ui graphics data
   struct {
     // ui widgets
     Array<QuadVertex> quad_vertices;
-    Array<uint> quad_elements;
     VertexBuffer quad_vb;
     Shader quad_shader;
 
@@ -2212,6 +3117,12 @@ struct GameState {
     Shader skybox_shader;
     RenderPipeline skybox_pipeline;
     VertexBuffer skybox_vb;
+
+    // @clouds
+    Shader cloud_shader;
+    RenderPipeline cloud_pipeline;
+    VertexBuffer cloud_vb;
+    v2 cloud_offset;
     CubeMap skybox;
     #define SKYBOX_TEXTURE_SIZE 128
     u8 skybox_texture_buffer[SKYBOX_TEXTURE_SIZE * SKYBOX_TEXTURE_SIZE * 3]; // 3 because of rgb
@@ -2219,11 +3130,25 @@ struct GameState {
 
   // world data
   struct {
-    // cache of block types
-    u8 block_types[NUM_BLOCKS_x][NUM_BLOCKS_y][NUM_BLOCKS_z];
-    // cache of the ground height (so we don't have to call perlin to calculate it all the time)
-    // 0 means it is unset
-    WorldXYData xy_cache[NUM_BLOCKS_x][NUM_BLOCKS_y];
+    // how far out we load and draw full resolution blocks, see set_view_distance
+    int view_distance;
+    // how many blocks the caches cover along x and y, see block_cache_width
+    int num_blocks_xy;
+    // cache of block types, [num_blocks_xy][num_blocks_xy][NUM_BLOCKS_z], see get_block_cache
+    u8 *block_types;
+    // cache of the ground height (so we don't have to call perlin to calculate it all the time), [num_blocks_xy][num_blocks_xy]
+    WorldXYCacheEntry *xy_cache;
+    // per-section bookkeeping, indexed the same way as block_types, see get_section
+    Section *sections;
+    // the most memory the view distance may need, in MB, or 0 for no limit. See view_distance_memory
+    int ram_budget, vram_budget;
+    // how far outside of the load area sections have to be before they are unloaded, see unload_margin
+    int unload_margin;
+    // the origins of the retained sections, the one that has been retained the longest first, see @residency
+    Array<Block> retained;
+    int num_reloads_avoided; // how many times a section came back into the load area while it was retained
+    // the load area around the player moved this far is also loaded, see @prefetch
+    v3i prefetch;
     // Array<BlockDiff> block_changes; // TODO: see push_blockdiff :)
   } world;
 
@@ -2276,88 +3201,514 @@ static Block pos_to_block(v3 p) {
   return {(int)floorf(p.x), (int)floorf(p.y), (int)floorf(p.z)};
 }
 
-#define FOR_BLOCKS_IN_RANGE_x for (int x = (int)floorf(state.player.pos.x) - NUM_VISIBLE_BLOCKS_x/2, x_end = (int)floorf(state.player.pos.x) + NUM_VISIBLE_BLOCKS_x/2; x < x_end; ++x)
-#define FOR_BLOCKS_IN_RANGE_y for (int y = (int)floorf(state.player.pos.y) - NUM_VISIBLE_BLOCKS_y/2, y_end = (int)floorf(state.player.pos.y) + NUM_VISIBLE_BLOCKS_y/2; y < y_end; ++y)
-#define FOR_BLOCKS_IN_RANGE_z for (int z = (int)floorf(state.player.pos.z) - NUM_VISIBLE_BLOCKS_z/2, z_end = (int)floorf(state.player.pos.z) + NUM_VISIBLE_BLOCKS_z/2; z < z_end; ++z)
+// how far outside of the load area sections are unloaded with some view distance, see @residency. At most half the
+// view distance, so that the range around the player (which has to hold them) still leaves room in the block cache
+static int unload_margin(int view_distance) {
+  return min(state.world.unload_margin, view_distance/2);
+}
+
+// how far the range around a player goes in each direction with some view distance
+static v3i range_radius(int view_distance) {
+  const int m = unload_margin(view_distance);
+  return {view_distance + m, view_distance + m, NUM_VISIBLE_BLOCKS_z/2 + m};
+}
 
 static Block range_get_bottom(Block b) {
-  return {b.x - NUM_VISIBLE_BLOCKS_x/2, b.y - NUM_VISIBLE_BLOCKS_y/2, b.z - NUM_VISIBLE_BLOCKS_z/2, };
+  return b - range_radius(state.world.view_distance);
 }
 
 // returned range is inclusive
 static BlockRange pos_to_range(v3 p) {
   Block b = pos_to_block(p);
-  return {
-    {b.x - NUM_VISIBLE_BLOCKS_x/2, b.y - NUM_VISIBLE_BLOCKS_y/2, b.z - NUM_VISIBLE_BLOCKS_z/2, },
-    {b.x + NUM_VISIBLE_BLOCKS_x/2 - 1, b.y + NUM_VISIBLE_BLOCKS_y/2 - 1, b.z + NUM_VISIBLE_BLOCKS_z/2 - 1}
-  };
+  const v3i r = range_radius(state.world.view_distance);
+  return {b - r, b + r - v3i{1,1,1}};
+}
+
+// @tasks
+// Work that any thread can do is split up into tasks, which worker threads run. Every thread has a deque of tasks:
+// a thread pushes tasks to the back of its own deque and takes them from there, so it does the newest ones first, while
+// what they need is still in its cache. A worker that has none left steals from the front of the other deques, where the
+// oldest ones are. Threads that aren't workers share the deque of the main thread.
+// Every task that is pushed to a deque posts state.tasks.wakeup once, and a worker runs at most one task per post, so
+// no task waits in a deque while a worker sleeps. A task can wait for the tasks of a counter (see push_task),
+// and a thread that waits for tasks runs tasks until they are done (see wait_for_tasks), which is how parallel_for works.
+// Work that should never hold up a thread that waits, like the block loader, is background work instead of tasks:
+// only the workers do it, when they are out of tasks, and whoever queues it posts state.tasks.wakeup the same way
+#define TASK_WAIT_SPINS 1000 // how many times a thread that waits for tasks looks for one to run before it sleeps a bit
+
+// which deque in state.tasks.deques belongs to this thread. 0 on threads that aren't workers
+static thread_local int task_deque_index;
+
+// let a worker know that there is one more task or piece of background work
+static void wake_task_worker() {
+  semaphore_post(state.tasks.wakeup);
+}
+
+static TaskDeque* my_task_deque() {
+  return &state.tasks.deques[task_deque_index];
+}
+
+// from the back of the deque, or from the front if we steal it. Returns false if the deque is empty
+static bool take_task(TaskDeque *d, bool steal, Task *task_out) {
+  spin_lock(&d->lock);
+  const bool found = d->tasks.size > d->top;
+  if (found)
+    *task_out = steal ? d->tasks[d->top++] : array_pop(d->tasks);
+  if (d->top == d->tasks.size)
+    d->tasks.size = d->top = 0;
+  spin_unlock(&d->lock);
+  return found;
+}
+
+static void push_task_to_deque(Task task) {
+  TaskDeque *d = my_task_deque();
+  spin_lock(&d->lock);
+  // the front was stolen, so make room for more at the back
+  if (d->top && d->top >= d->tasks.size/2) {
+    array_remove_slown(d->tasks, 0, d->top);
+    d->top = 0;
+  }
+  array_push(d->tasks, task);
+  spin_unlock(&d->lock);
+  wake_task_worker();
+}
+
+// Queue a task. Its counter (if it has one) counts it from now until it's done. With after, it isn't run until after
+// has no tasks left. Safe to call from any thread
+static void push_task(Task task, TaskCounter *after = NULL) {
+  if (task.counter)
+    atomic_inc(&task.counter->tasks);
+  if (after) {
+    spin_lock(&after->lock);
+    const bool wait = atomic_get(&after->tasks) > 0;
+    if (wait)
+      array_push(after->waiting, task);
+    spin_unlock(&after->lock);
+    if (wait)
+      return;
+  }
+  push_task_to_deque(task);
+}
+
+static void run_task(const Task &task) {
+  task.function(task.data, task.begin, task.end);
+  TaskCounter *c = task.counter;
+  if (!c)
+    return;
+  // The counter can go away as soon as it says there are no tasks left, and someone that waits for it takes the lock
+  // before it goes (see wait_for_tasks), so we hold it until we are done with it
+  spin_lock(&c->lock);
+  if (atomic_dec(&c->tasks)) {
+    for (int i = 0; i < c->waiting.size; ++i)
+      push_task_to_deque(c->waiting[i]);
+    c->waiting.size = 0;
+  }
+  spin_unlock(&c->lock);
+}
+
+// run a task from our own deque, or one stolen from another thread. Returns false if there were none
+static bool run_one_task() {
+  TaskDeque *mine = my_task_deque();
+  Task task;
+  bool found = take_task(mine, false, &task);
+  const int num_deques = state.tasks.num_workers + 1;
+  for (int i = 1; i < num_deques && !found; ++i) {
+    found = take_task(&state.tasks.deques[(mine - state.tasks.deques + i) % num_deques], true, &task);
+    if (found)
+      atomic_inc(&state.tasks.num_stolen);
+  }
+  if (found)
+    run_task(task);
+  return found;
+}
+
+// run tasks until the counter has none left. Safe to call from any thread
+static void wait_for_tasks(TaskCounter *counter) {
+  int spins = 0;
+  while (atomic_get(&counter->tasks) > 0) {
+    if (run_one_task())
+      spins = 0;
+    else if (++spins > TASK_WAIT_SPINS)
+      mine_yield();
+  }
+  // let the last task let go of it, see run_task
+  spin_lock(&counter->lock);
+  spin_unlock(&counter->lock);
+}
+
+// call function for all of [0, n), in tasks of up to per_task at a time, and wait for them
+static void parallel_for(int n, int per_task, TaskFunction function, void *data) {
+  TaskCounter counter = {};
+  for (int i = 0; i < n; i += per_task)
+    push_task({function, data, i, min(i + per_task, n), &counter});
+  wait_for_tasks(&counter);
+  array_free(counter.waiting);
+}
+
+static int task_worker_thread(void *deque_index) {
+  task_deque_index = (int)(intptr_t)deque_index;
+  for (;;) {
+    semaphore_wait(state.tasks.wakeup);
+    if (atomic_get(&state.tasks.quit))
+      return 0;
+    if (!run_one_task() && state.tasks.background_work)
+      state.tasks.background_work();
+  }
+}
+
+static void tasks_init(int num_workers) {
+  state.tasks.wakeup = semaphore_create();
+  atomic_set(&state.tasks.quit, 0);
+  state.tasks.num_workers = clamp(num_workers, 0, MAX_TASK_WORKERS);
+  for (int i = 0; i < state.tasks.num_workers; ++i)
+    state.tasks.workers[i] = thread_create(task_worker_thread, (void*)(intptr_t)(i+1));
+}
+
+// stop the workers. There must be no tasks left
+static void tasks_quit() {
+  atomic_set(&state.tasks.quit, 1);
+  for (int i = 0; i < state.tasks.num_workers; ++i)
+    semaphore_post(state.tasks.wakeup);
+  for (int i = 0; i < state.tasks.num_workers; ++i)
+    thread_wait(state.tasks.workers[i]);
+  semaphore_destroy(state.tasks.wakeup);
+  state.tasks.num_workers = 0;
+}
+
+// @loadarea
+// We don't load all of the range around the player, only the sections of it that are inside a cylinder: the ones
+// within the view distance of the player horizontally (the corners of the range are past the fog anyway), and of those,
+// the ones the ground can be in, plus the ones close to the player. The rest of the range is mostly air and bedrock,
+// and is left unloaded. get_blocktype calculates those blocks when someone asks for them
+#define LOAD_AREA_TOP 128 // the ground never goes above 30 + 2^6, see generate_xy_data
+#define LOAD_AREA_PLAYER_BAND 32 // how far above and below the player we load, so that the blocks you can reach are always loaded
+
+// whether the section that block b is in is in the load area of a player standing in block p, with the view distance
+// view_distance. With a margin, it's whether it's in the load area grown by that many blocks in every direction, which
+// is what is kept loaded (see @residency). Everything in it is also inside the range around the player
+static bool load_area_contains_section(Block p, int view_distance, Block b, int margin = 0) {
+  const Block origin = {b.x & ~(SECTION_SIZE-1), b.y & ~(SECTION_SIZE-1), b.z & ~(SECTION_SIZE-1)};
+  const Block end = origin + v3i{SECTION_SIZE, SECTION_SIZE, SECTION_SIZE}; // exclusive
+
+  // the corner of the section farthest from the player has to be in the circle
+  const int r = view_distance + margin;
+  const int dx = max(p.x - origin.x, end.x - p.x);
+  const int dy = max(p.y - origin.y, end.y - p.y);
+  if (dx*dx + dy*dy > r*r)
+    return false;
+
+  if (origin.z < p.z - NUM_VISIBLE_BLOCKS_z/2 - margin || end.z > p.z + NUM_VISIBLE_BLOCKS_z/2 + margin)
+    return false;
+  return (origin.z < LOAD_AREA_TOP + margin && end.z > -margin) ||
+         (origin.z < p.z + LOAD_AREA_PLAYER_BAND + margin && end.z > p.z - LOAD_AREA_PLAYER_BAND - margin);
+}
+
+static bool load_area_contains_section(Block p, Block b) {
+  return load_area_contains_section(p, state.world.view_distance, b);
 }
 
 static inline BlockIndex block_to_blockindex(Block b) {
-  return {b.x & (NUM_BLOCKS_x-1), b.y & (NUM_BLOCKS_y-1), b.z & (NUM_BLOCKS_z-1)};
+  const int mask = state.world.num_blocks_xy - 1;
+  return {b.x & mask, b.y & mask, b.z & (NUM_BLOCKS_z-1)};
 }
 
 STATIC_ASSERT(BLOCKTYPES_MAX <= 255, blocktypes_fit_in_u8);
 
+// where block b is in state.world.block_types. The blocks above it in the same section come right after it
+static inline u8* get_block_cache(BlockIndex b) {
+  return &state.world.block_types[((size_t)b.x*state.world.num_blocks_xy + b.y)*NUM_BLOCKS_z + b.z];
+}
+
 static inline void set_blocktype_cache(BlockIndex b, BlockType t) {
-  state.world.block_types[b.x][b.y][b.z] = (u8)t;
+  *get_block_cache(b) = (u8)t;
 }
 
 static inline void set_blocktype_cache(Block b, BlockType t) {
   set_blocktype_cache(block_to_blockindex(b), t);
 }
 
-static inline WorldXYData get_world_xy_cache(BlockIndex b) {
-  return state.world.xy_cache[b.x][b.y];
+// Get the xy data of the column at b, if it's in the cache. Safe to call from any thread.
+// Returns false if the entry is for another column, or if someone is writing to it right now
+static bool get_world_xy_cache(Block b, WorldXYData *out) {
+  const BlockIndex bi = block_to_blockindex(b);
+  WorldXYCacheEntry &e = state.world.xy_cache[bi.x*state.world.num_blocks_xy + bi.y];
+  const int version = atomic_get(&e.version);
+  if (!version || (version & 1))
+    return false;
+  const int x = e.x, y = e.y;
+  const WorldXYData data = e.data;
+  memory_barrier_acquire();
+  if (atomic_get(&e.version) != version || x != b.x || y != b.y)
+    return false;
+  *out = data;
+  return true;
 }
 
-static inline void set_world_xy_cache(BlockIndex b, WorldXYData c) {
-  state.world.xy_cache[b.x][b.y] = c;
+// Safe to call from any thread. If someone else is writing to the entry, we let them, and the column just isn't cached
+static void set_world_xy_cache(Block b, WorldXYData data) {
+  const BlockIndex bi = block_to_blockindex(b);
+  WorldXYCacheEntry &e = state.world.xy_cache[bi.x*state.world.num_blocks_xy + bi.y];
+  const int version = atomic_get(&e.version);
+  if ((version & 1) || !atomic_cas(&e.version, version, version+1))
+    return;
+  e.x = b.x, e.y = b.y;
+  e.data = data;
+  atomic_add(&e.version, 1);
 }
 
-static inline void clear_world_xy_cache(BlockIndex b) {
-  state.world.xy_cache[b.x][b.y].groundlevel = 0;
+static void clear_world_xy_cache(BlockIndex b) {
+  WorldXYCacheEntry &e = state.world.xy_cache[b.x*state.world.num_blocks_xy + b.y];
+  const int version = atomic_get(&e.version);
+  if ((version & 1) || !atomic_cas(&e.version, version, version+1))
+    return;
+  e.x = e.y = INT_MIN; // no column has this
+  atomic_add(&e.version, 1);
 }
 
+// A single block is a single byte, so it's never half written and doesn't need section_read_begin.
+// Use that when you read several blocks that have to agree with each other, like gather_section_blocks does
 static BlockType get_blocktype_cache(BlockIndex b) {
-  return (BlockType)state.world.block_types[b.x][b.y][b.z];
+  return (BlockType)*get_block_cache(b);
 }
 
 static BlockType get_blocktype_cache(Block b) {
   return get_blocktype_cache(block_to_blockindex(b));
 }
 
-static u64 block_vertex_pos_index(BlockIndex b, Direction dir) {
-  u64 x = (u64)b.x + (u64)NUM_BLOCKS_x/2 + 1;
-  u64 y = (u64)b.y + (u64)NUM_BLOCKS_y/2 + 1;
-  u64 z = (u64)b.z + (u64)NUM_BLOCKS_z/2 + 1;
-  return
-    z * (NUM_BLOCKS_x+1) * (NUM_BLOCKS_y+1) * (DIRECTION_MAX+1) +
-    y * (NUM_BLOCKS_x+1) * (DIRECTION_MAX+1) +
-    x * (DIRECTION_MAX+1) +
-    (u64)dir;
+STATIC_ASSERT(NUM_BLOCKS_z % SECTION_SIZE == 0, sections_fit_in_block_cache);
+
+static inline Section* get_section(BlockIndex b) {
+  const int num_sections_xy = state.world.num_blocks_xy >> SECTION_SIZE_BITS;
+  return &state.world.sections[((b.x >> SECTION_SIZE_BITS)*num_sections_xy + (b.y >> SECTION_SIZE_BITS))*NUM_SECTIONS_z + (b.z >> SECTION_SIZE_BITS)];
+}
+
+// @seqlock
+// The block loader's tasks write to the block cache while other threads read from it. So that readers don't have to
+// lock, every section has a version. A writer makes it odd, writes, and makes it even again. A reader reads the
+// version, reads the blocks, and reads the version again, and if it was the same and even, it didn't see anything
+// half written. Writers still have to take state.block_loader.lock, so that only one of them writes at a time
+
+static int section_read_begin(Section *s) {
+  int version;
+  while ((version = atomic_get(&s->version)) & 1)
+    ;
+  return version;
+}
+
+// false if someone wrote to the section since section_read_begin, and we have to read it again
+static bool section_read_end(Section *s, int version) {
+  memory_barrier_acquire();
+  return atomic_get(&s->version) == version;
+}
+
+static void section_write_begin(Section *s) {
+  atomic_add(&s->version, 1);
+}
+
+static void section_write_end(Section *s) {
+  atomic_add(&s->version, 1);
 }
-STATIC_ASSERT(NUM_BLOCKS_x*NUM_BLOCKS_y*NUM_BLOCKS_z*DIRECTION_MAX < UINT32_MAX, num_block_faces_fit_in_u32);
 
-static int* get_block_vertex_pos(BlockIndex b, Direction dir) {
-  u64 key = block_vertex_pos_index(b, dir);
-  int *value = state.block_vertex_pos.get(key);
-  return value;
+// index of a block inside of its section, in the same order as the block cache
+static inline int section_block_index(BlockIndex b) {
+  const int x = b.x & (SECTION_SIZE-1);
+  const int y = b.y & (SECTION_SIZE-1);
+  const int z = b.z & (SECTION_SIZE-1);
+  return (x*SECTION_SIZE + y)*SECTION_SIZE + z;
 }
 
-static int* get_block_vertex_pos(Block b, Direction dir) {
-  return get_block_vertex_pos(block_to_blockindex(b), dir);
+// index of a block face inside of its section
+static inline int section_face_index(BlockIndex b, Direction dir) {
+  const int x = b.x & (SECTION_SIZE-1);
+  const int y = b.y & (SECTION_SIZE-1);
+  const int z = b.z & (SECTION_SIZE-1);
+  return ((z*SECTION_SIZE + y)*SECTION_SIZE + x)*DIRECTION_MAX + dir;
 }
 
-static void remove_block_vertex_pos(int *value) {
-  state.block_vertex_pos.remove(value);
+// returns the position of the face in the vertex arrays, or -1 if the face is not shown
+static int get_block_face_slot(BlockIndex b, Direction dir) {
+  const Section *s = get_section(b);
+  if (!s->face_slots)
+    return -1;
+  return s->face_slots[section_face_index(b, dir)] - 1;
 }
 
-static void set_block_vertex_pos(BlockIndex b, Direction dir, int pos) {
-  u64 key = block_vertex_pos_index(b, dir);
-  state.block_vertex_pos.set(key, pos);
+static int get_block_face_slot(Block b, Direction dir) {
+  return get_block_face_slot(block_to_blockindex(b), dir);
+}
+
+static void set_block_face_slot(BlockIndex b, Direction dir, int slot) {
+  Section *s = get_section(b);
+  if (!s->face_slots) {
+    s->face_slots = (int*)calloc(SECTION_NUM_FACES, sizeof(*s->face_slots));
+    if (!s->face_slots)
+      die("Failed to allocate face slots for section");
+  }
+
+  int &f = s->face_slots[section_face_index(b, dir)];
+  if (!f)
+    ++s->num_faces;
+  f = slot + 1;
+}
+
+static void remove_block_face_slot(BlockIndex b, Direction dir) {
+  Section *s = get_section(b);
+  if (!s->face_slots)
+    return;
+
+  int &f = s->face_slots[section_face_index(b, dir)];
+  if (!f)
+    return;
+  f = 0;
+  --s->num_faces;
+}
+
+// identifies a block face in the cache, so we know which face lives in which slot of a BlockMesh
+#define BLOCK_FACE_KEY_NONE UINT32_MAX
+// The keys are the same for all block cache sizes, so they don't have to look at the view distance
+STATIC_ASSERT((u64)MAX_NUM_BLOCKS_xy*MAX_NUM_BLOCKS_xy*NUM_BLOCKS_z*DIRECTION_MAX < UINT32_MAX, block_face_keys_fit_in_u32);
+
+static u32 block_face_key(BlockIndex b, Direction dir) {
+  return (((u32)dir*NUM_BLOCKS_z + b.z)*MAX_NUM_BLOCKS_xy + b.y)*MAX_NUM_BLOCKS_xy + b.x;
+}
+
+static void block_face_key_unpack(u32 key, BlockIndex *b, Direction *dir) {
+  b->x = key % MAX_NUM_BLOCKS_xy, key /= MAX_NUM_BLOCKS_xy;
+  b->y = key % MAX_NUM_BLOCKS_xy, key /= MAX_NUM_BLOCKS_xy;
+  b->z = key % NUM_BLOCKS_z, key /= NUM_BLOCKS_z;
+  *dir = (Direction)key;
+}
+
+// which slab of sections a face is in, along the axis of its direction
+static int block_mesh_slab(BlockIndex b, Direction dir) {
+  switch (dir) {
+    case DIRECTION_X: case DIRECTION_MINUS_X: return b.x >> SECTION_SIZE_BITS;
+    case DIRECTION_Y: case DIRECTION_MINUS_Y: return b.y >> SECTION_SIZE_BITS;
+    default: return b.z >> SECTION_SIZE_BITS;
+  }
+}
+
+// the bucket a face of a block of type t goes in
+static BlockMesh& get_block_mesh(BlockType t, BlockIndex b, Direction dir) {
+  return state.block_meshes[blocktype_is_transparent(t)][dir][block_mesh_slab(b, dir)];
+}
+
+struct BlockMeshTotals {
+  int vertices, faces, holes;
+};
+
+// added up over all the buckets of opaque or transparent faces
+static BlockMeshTotals block_mesh_totals(bool transparent) {
+  BlockMeshTotals t = {};
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i) {
+    const BlockMesh &m = state.block_meshes[transparent][d][i];
+    t.vertices += m.vertices.size;
+    t.faces += m.face_keys.size - 1; // first slot is the null face
+    t.holes += m.num_holes;
+  }
+  return t;
+}
+
+static int block_mesh_num_faces(const BlockMesh &m) {
+  return m.face_keys.size;
+}
 
-  assert(*state.block_vertex_pos.get(key) == pos);
+// returns a slot for a new face, either a hole or a new slot at the end
+static int block_mesh_alloc_face(BlockMesh &m) {
+  while (m.num_holes) {
+    if (!m.free_faces.size)
+      die("Block mesh has %i holes but none are in the free list", m.num_holes);
+    const int i = array_pop(m.free_faces);
+    if (i < block_mesh_num_faces(m) && m.face_keys[i] == BLOCK_FACE_KEY_NONE) {
+      --m.num_holes;
+      return i;
+    }
+  }
+  // no holes, so whatever is left in the free list is stale
+  m.free_faces.size = 0;
+
+  const int i = block_mesh_num_faces(m);
+  array_pushn(m.vertices, 4);
+  array_pushn(m.face_keys, 1);
+  return i;
+}
+
+// mark the vertices of a slot as changed, so they get sent to the gpu
+static void block_mesh_touch(BlockMesh &m, int slot) {
+  const int page = slot / BLOCK_MESH_PAGE_FACES;
+  if (page >= m.dirty_pages.size) {
+    const int n = m.dirty_pages.size;
+    array_resize(m.dirty_pages, page+1);
+    array_zero(m.dirty_pages, n, page+1-n);
+  }
+  m.dirty_pages[page] = 1;
+  m.dirty = true;
+}
+
+static void block_mesh_free_face(BlockMesh &m, int slot) {
+  array_zero(m.vertices, slot*4, 4);
+  m.face_keys[slot] = BLOCK_FACE_KEY_NONE;
+  array_push(m.free_faces, slot);
+  ++m.num_holes;
+  block_mesh_touch(m, slot);
+}
+
+static void block_mesh_resize(BlockMesh &m, int num_faces) {
+  array_resize(m.vertices, num_faces*4);
+  array_resize(m.face_keys, num_faces);
+}
+
+// how much of the meshes are holes, in [0,1]
+static float block_mesh_fragmentation(const BlockMeshTotals &t) {
+  return t.faces > 0 ? (float)t.holes / t.faces : 0.0f;
+}
+
+// Fills holes with faces from the end of the mesh, so that the arrays (and what we upload and draw)
+// shrink back down to the number of faces that are actually shown.
+// Does at most max_moves moves, so that it can be spread out over many frames, and returns how many it did.
+// WARNING: changes face slots, so only call this from the main thread
+static int compact_block_mesh(BlockMesh &m, int max_moves) {
+  int moves = 0;
+  while (moves < max_moves && m.num_holes) {
+    // drop the holes at the end
+    int n = block_mesh_num_faces(m);
+    while (n > 1 && m.face_keys[n-1] == BLOCK_FACE_KEY_NONE)
+      --n, --m.num_holes;
+    if (n != block_mesh_num_faces(m)) {
+      block_mesh_resize(m, n);
+      m.dirty = true;
+    }
+    if (!m.num_holes)
+      break;
+
+    const int hole = array_pop(m.free_faces);
+    if (hole >= n || m.face_keys[hole] != BLOCK_FACE_KEY_NONE)
+      continue;
+
+    // move the last face into the hole
+    const int last = n-1;
+    memcpy(&m.vertices[hole*4], &m.vertices[last*4], 4*sizeof(m.vertices[0]));
+    m.face_keys[hole] = m.face_keys[last];
+    BlockIndex b;
+    Direction dir;
+    block_face_key_unpack(m.face_keys[hole], &b, &dir);
+    set_block_face_slot(b, dir, hole);
+    block_mesh_resize(m, last);
+    --m.num_holes;
+    ++moves;
+    block_mesh_touch(m, hole);
+  }
+
+  if (!m.num_holes)
+    m.free_faces.size = 0;
+
+  // give back memory if we shrunk a lot
+  if (m.vertices.size < m.vertices.cap/4) {
+    array_shrink(m.vertices);
+    array_shrink(m.face_keys);
+  }
+  return moves;
 }
 
 static void blocktype_to_texpos_top(BlockType t, u16 *x0, u16 *y0, u16 *x1, u16 *y1) {
@@ -2418,158 +3769,215 @@ static void blocktype_to_texpos(BlockType t, float *x, float *y, float *w, float
   *h = 1.0f/(BLOCKTYPES_MAX-2);
 }
 
-static void push_block_face(Block block, BlockType type, Direction dir) {
-  const bool transparent = blocktype_is_transparent(type);
-
-  // pick transparent or opaque vertices
-  Array<WorldObjectVertex> &block_vertices = transparent ? state.transparent_block_vertices : state.block_vertices;
-  Array<int> &free_faces = transparent ? state.free_transparent_faces : state.free_faces;
-  Array<uint> &block_elements = transparent ? state.transparent_block_elements : state.block_elements;
-
-  BlockIndex bi = block_to_blockindex(block);
-  // does face already exist?
-  int *vertex_pos = get_block_vertex_pos(bi, dir);
-  if (vertex_pos)
-    return;
+// @ao
+// Corners of faces are darkened by the blocks next to them (see https://0fps.net/2013/07/03/ambient-occlusion-for-minecraft-like-worlds/).
+// The occlusion of a corner is decided by the 3 blocks that touch it in the layer in front of the face, which the mesher
+// already looks at, so it's baked into the vertices when they are made.
+// BlockOcclusion is a mask of which of the 3x3x3 blocks around a block hide light, see block_occlusion_bit
+typedef u32 BlockOcclusion;
 
-  if (transparent) state.transparent_block_vertices_dirty = true;
-  else             state.block_vertices_dirty = true;
+static u32 block_occlusion_bit(int x, int y, int z) {
+  return (u32)1 << ((x+1)*9 + (y+1)*3 + (z+1));
+}
 
-  const v3 p =  {(float)block.x, (float)block.y, (float)block.z};
-  const v3 p2 = {(float)(block.x+1), (float)(block.y+1), (float)(block.z+1)};
+static bool blocktype_occludes(BlockType t) {
+  return t != BLOCKTYPE_NULL && !blocktype_is_transparent(t);
+}
 
-  r2 ttop = blocktype_to_texpos_top(type);
-  r2 tside = blocktype_to_texpos_side(type);
-  r2 tbot = blocktype_to_texpos_bottom(type);
+// 0 to 3. s1 and s2 are the blocks on each side of the corner and c the block diagonally from it, as offsets from the block
+static int block_corner_occlusion(BlockOcclusion o, v3i s1, v3i s2, v3i c) {
+  const bool a = (o & block_occlusion_bit(s1.x, s1.y, s1.z)) != 0;
+  const bool b = (o & block_occlusion_bit(s2.x, s2.y, s2.z)) != 0;
+  // if both sides are blocked, the corner is as dark as it gets, no matter what's in it
+  if (a && b)
+    return 3;
+  return a + b + ((o & block_occlusion_bit(c.x, c.y, c.z)) != 0);
+}
 
-  int v, el;
-  // check if there are any free vertex slots
-  if (free_faces.size) {
-    int i = array_pop(free_faces);
-    v = i*4; // 4 block_vertices per face
-    el = i*6; // 6 block_elements per face
+static void block_face_occlusion(Block block, Direction dir, BlockOcclusion o, WorldObjectVertex v[4]) {
+  const v3 normal = direction_to_normal(dir);
+  const v3i n = {(int)normal.x, (int)normal.y, (int)normal.z};
+  int occlusion[4];
+  for (int i = 0; i < 4; ++i) {
+    // which way the corner is from the middle of the face
+    const v3i c = {
+      n.x ? n.x : v[i].pos.x > block.x + 0.5f ? 1 : -1,
+      n.y ? n.y : v[i].pos.y > block.y + 0.5f ? 1 : -1,
+      n.z ? n.z : v[i].pos.z > block.z + 0.5f ? 1 : -1,
+    };
+    const v3i s1 = n.x ? v3i{n.x, c.y, 0} : v3i{c.x, n.y, n.z};
+    const v3i s2 = n.z ? v3i{0, c.y, n.z} : v3i{n.x, n.y, c.z};
+    occlusion[i] = block_corner_occlusion(o, s1, s2, c);
+    v[i].occlusion.x = occlusion[i] / 3.0f;
   }
-  else {
-    // else push at the end
-    v = block_vertices.size;
-    array_pushn(block_vertices, 4);
-    el = block_elements.size;
-    array_pushn(block_elements, 6);
+
+  // the quad is drawn as two triangles split along 0-2. The occlusion is interpolated over each triangle, so if the
+  // other diagonal is darker we split along it instead, or the darkness gets smeared over the wrong half of the face
+  if (occlusion[1] + occlusion[3] > occlusion[0] + occlusion[2]) {
+    const WorldObjectVertex first = v[0];
+    v[0] = v[1], v[1] = v[2], v[2] = v[3], v[3] = first;
   }
-  set_block_vertex_pos(bi, dir, v/4);
-  assert(*get_block_vertex_pos(bi, dir) == v/4);
+}
 
+// the 4 vertices of the face of the box [p, p2] that faces dir, with the texture t stretched over it
+static void box_face_vertices(v3 p, v3 p2, Direction dir, r2 t, WorldObjectVertex vertices[4]) {
   const v3 normal = direction_to_normal(dir);
 
   switch (dir) {
     case DIRECTION_UP: {
-      block_vertices[v] =   {p.x,  p.y,  p2.z, ttop.x0,  ttop.y0,  normal};
-      block_vertices[v+1] = {p2.x, p.y,  p2.z, ttop.x1, ttop.y0,  normal};
-      block_vertices[v+2] = {p2.x, p2.y, p2.z, ttop.x1, ttop.y1, normal};
-      block_vertices[v+3] = {p.x,  p2.y, p2.z, ttop.x0,  ttop.y1, normal};
+      vertices[0] = {p.x,  p.y,  p2.z, t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p2.x, p.y,  p2.z, t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p2.x, p2.y, p2.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p.x,  p2.y, p2.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     case DIRECTION_DOWN: {
-      block_vertices[v] =   {p2.x, p.y,  p.z, tbot.x0,  tbot.y0,  normal};
-      block_vertices[v+1] = {p.x,  p.y,  p.z, tbot.x1, tbot.y0,  normal};
-      block_vertices[v+2] = {p.x,  p2.y, p.z, tbot.x1, tbot.y1, normal};
-      block_vertices[v+3] = {p2.x, p2.y, p.z, tbot.x0,  tbot.y1, normal};
+      vertices[0] = {p2.x, p.y,  p.z, t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p.x,  p.y,  p.z, t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p.x,  p2.y, p.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p2.x, p2.y, p.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     case DIRECTION_X: {
-      block_vertices[v] =   {p2.x, p.y,  p.z,  tside.x0,  tside.y0,  normal};
-      block_vertices[v+1] = {p2.x, p2.y, p.z,  tside.x1, tside.y0,  normal};
-      block_vertices[v+2] = {p2.x, p2.y, p2.z, tside.x1, tside.y1, normal};
-      block_vertices[v+3] = {p2.x, p.y,  p2.z, tside.x0,  tside.y1, normal};
+      vertices[0] = {p2.x, p.y,  p.z,  t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p2.x, p2.y, p.z,  t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p2.x, p2.y, p2.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p2.x, p.y,  p2.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     case DIRECTION_Y: {
-      block_vertices[v] =   {p2.x, p2.y, p.z,  tside.x0,  tside.y0,  normal};
-      block_vertices[v+1] = {p.x,  p2.y, p.z,  tside.x1, tside.y0,  normal};
-      block_vertices[v+2] = {p.x,  p2.y, p2.z, tside.x1, tside.y1, normal};
-      block_vertices[v+3] = {p2.x, p2.y, p2.z, tside.x0,  tside.y1, normal};
+      vertices[0] = {p2.x, p2.y, p.z,  t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p.x,  p2.y, p.z,  t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p.x,  p2.y, p2.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p2.x, p2.y, p2.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     case DIRECTION_MINUS_X: {
-      block_vertices[v] =   {p.x, p2.y, p.z,  tside.x0,  tside.y0,  normal};
-      block_vertices[v+1] = {p.x, p.y,  p.z,  tside.x1, tside.y0,  normal};
-      block_vertices[v+2] = {p.x, p.y,  p2.z, tside.x1, tside.y1, normal};
-      block_vertices[v+3] = {p.x, p2.y, p2.z, tside.x0,  tside.y1, normal};
+      vertices[0] = {p.x, p2.y, p.z,  t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p.x, p.y,  p.z,  t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p.x, p.y,  p2.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p.x, p2.y, p2.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     case DIRECTION_MINUS_Y: {
-      block_vertices[v] =   {p.x,  p.y, p.z,  tside.x0,  tside.y0,  normal};
-      block_vertices[v+1] = {p2.x, p.y, p.z,  tside.x1, tside.y0,  normal};
-      block_vertices[v+2] = {p2.x, p.y, p2.z, tside.x1, tside.y1, normal};
-      block_vertices[v+3] = {p.x,  p.y, p2.z, tside.x0,  tside.y1, normal};
+      vertices[0] = {p.x,  p.y, p.z,  t.x0, t.y0, normal, {0.0f}};
+      vertices[1] = {p2.x, p.y, p.z,  t.x1, t.y0, normal, {0.0f}};
+      vertices[2] = {p2.x, p.y, p2.z, t.x1, t.y1, normal, {0.0f}};
+      vertices[3] = {p.x,  p.y, p2.z, t.x0, t.y1, normal, {0.0f}};
     } break;
 
     default: return;
   }
+}
+
+static void block_face_vertices(Block block, BlockType type, Direction dir, BlockOcclusion occluders, WorldObjectVertex block_vertices[4]) {
+  const v3 p =  {(float)block.x, (float)block.y, (float)block.z};
+  const v3 p2 = {(float)(block.x+1), (float)(block.y+1), (float)(block.z+1)};
+
+  switch (dir) {
+    case DIRECTION_UP: box_face_vertices(p, p2, dir, blocktype_to_texpos_top(type), block_vertices); break;
+    case DIRECTION_DOWN: box_face_vertices(p, p2, dir, blocktype_to_texpos_bottom(type), block_vertices); break;
+    case DIRECTION_X: case DIRECTION_Y: case DIRECTION_MINUS_X: case DIRECTION_MINUS_Y:
+      box_face_vertices(p, p2, dir, blocktype_to_texpos_side(type), block_vertices); break;
+    default: return;
+  }
+
+  if (occluders)
+    block_face_occlusion(block, dir, occluders, block_vertices);
+}
+
+// show a face with vertices that are already made, like the ones from the mesh cache
+static void push_block_face_vertices(BlockIndex bi, BlockType type, Direction dir, const WorldObjectVertex vertices[4]) {
+  BlockMesh &mesh = get_block_mesh(type, bi, dir);
+
+  // does face already exist?
+  if (get_block_face_slot(bi, dir) != -1)
+    return;
 
-  block_elements[el]   = v;
-  block_elements[el+1] = v+1;
-  block_elements[el+2] = v+2;
-  block_elements[el+3] = v;
-  block_elements[el+4] = v+2;
-  block_elements[el+5] = v+3;
+  const int slot = block_mesh_alloc_face(mesh);
+  mesh.face_keys[slot] = block_face_key(bi, dir);
+  set_block_face_slot(bi, dir, slot);
+  assert(get_block_face_slot(bi, dir) == slot);
+
+  memcpy(&mesh.vertices[slot*4], vertices, 4*sizeof(*vertices));
+  block_mesh_touch(mesh, slot);
+}
+
+static void push_block_face(Block block, BlockType type, Direction dir, BlockOcclusion occluders) {
+  WorldObjectVertex v[4];
+  block_face_vertices(block, type, dir, occluders, v);
+  push_block_face_vertices(block_to_blockindex(block), type, dir, v);
+}
+
+static void reset_block_mesh(BlockMesh &m) {
+  // make first slot contain the null face
+  block_mesh_resize(m, 1);
+  array_zero(m.vertices);
+  m.face_keys[0] = BLOCK_FACE_KEY_NONE;
+  m.free_faces.size = 0;
+  m.num_holes = 0;
+  block_mesh_touch(m, 0);
 }
 
 static void reset_block_vertices() {
-  // make first 4 block_vertices contain the null block
-  array_resize(state.block_vertices, 4);
-  array_zero(state.block_vertices);
-  array_resize(state.transparent_block_vertices, 4);
-  array_zero(state.transparent_block_vertices);
-  array_resize(state.block_elements, 6);
-  array_zero(state.block_elements);
-  array_resize(state.transparent_block_elements, 6);
-  array_zero(state.transparent_block_elements);
+  for (int t = 0; t < 2; ++t)
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i)
+    reset_block_mesh(state.block_meshes[t][d][i]);
 }
 
 static bool is_block_in_range(Block b) {
   Block p = pos_to_block(state.player.pos);
+  const v3i r = range_radius(state.world.view_distance);
   return
-    b.x - p.x <   NUM_VISIBLE_BLOCKS_x/2 &&
-    b.x - p.x >= -NUM_VISIBLE_BLOCKS_x/2 &&
-    b.y - p.y <   NUM_VISIBLE_BLOCKS_y/2 &&
-    b.y - p.y >= -NUM_VISIBLE_BLOCKS_y/2 &&
-    b.z - p.z <   NUM_VISIBLE_BLOCKS_z/2 &&
-    b.z - p.z >= -NUM_VISIBLE_BLOCKS_z/2;
-}
-
-static BlockType generate_blocktype(Block b) {
-  const BlockIndex bi = block_to_blockindex(b);
-
+    b.x - p.x <   r.x &&
+    b.x - p.x >= -r.x &&
+    b.y - p.y <   r.y &&
+    b.y - p.y >= -r.y &&
+    b.z - p.z <   r.z &&
+    b.z - p.z >= -r.z;
+}
+
+#define WORLD_WATER_LEVEL 13
+// clouds aren't blocks, they are drawn as a plane at this height (see render_clouds)
+#define WORLD_CLOUD_HEIGHT 40
+
+// the generation stuff that is the same for all z at some (x,y). Doesn't touch any caches, so it is safe to call from any thread
+static WorldXYData generate_xy_data(int x, int y) {
+  static const float stone_freq = 0.13f;
+  static const float ground_freq = 0.05f;
   WorldXYData xy_data;
-  const int waterlevel = 13;
-
-  // to not having to recalculate stuff that are constant for all z, for a specific (x,y)
-  // like ground level and water level, we keep a cache of it.
-  // turns out it is MUCH faster :D
-  // we have convention that groundlevel == 0 means cache is empty
-  xy_data = get_world_xy_cache(bi);
-  if (!xy_data.groundlevel) {
-    static const float stone_freq = 0.13f;
-    static const float ground_freq = 0.05f;
-    float crazy_hills = max(powf(perlin(b.x*ground_freq*1.0f, b.y*ground_freq*1.0f, 0) * 2.0f, 6), 0.0f);
-    xy_data.groundlevel = (int)ceilf(perlin(b.x*ground_freq*0.7f, b.y*ground_freq*0.7f, 0) * 30.0f + crazy_hills); //50.0f;
-    xy_data.stonelevel = (int)ceilf(10.0f + perlin(b.x*stone_freq, b.y*stone_freq, 0) * 5.0f); // 20.0f;
-    set_world_xy_cache(bi, xy_data);
-  }
+  float crazy_hills = max(powf(perlin(x*ground_freq*1.0f, y*ground_freq*1.0f, 0) * 2.0f, 6), 0.0f);
+  xy_data.groundlevel = (int)ceilf(perlin(x*ground_freq*0.7f, y*ground_freq*0.7f, 0) * 30.0f + crazy_hills); //50.0f;
+  xy_data.stonelevel = (int)ceilf(10.0f + perlin(x*stone_freq, y*stone_freq, 0) * 5.0f); // 20.0f;
+  return xy_data;
+}
 
+// same as generate_blocktype(Block), but with the xy data already calculated. Also safe to call from any thread
+static BlockType generate_blocktype(Block b, const WorldXYData &xy_data) {
   if (b.z < xy_data.groundlevel && b.z < xy_data.stonelevel)
     return BLOCKTYPE_STONE;
   if (b.z < xy_data.groundlevel)
     return BLOCKTYPE_DIRT;
-  if (b.z < waterlevel)
+  if (b.z < WORLD_WATER_LEVEL)
     return BLOCKTYPE_WATER;
+  return BLOCKTYPE_AIR;
+}
 
-  // flying blocks clusters
-  if (b.z >= 35 && b.z <= 40 && perlin(b.x*0.05f, b.y*0.05f, b.z*0.2f) > 0.75)
-    return BLOCKTYPE_CLOUD;
+static WorldXYData get_world_xy_data(Block b) {
+  // to not having to recalculate stuff that are constant for all z, for a specific (x,y)
+  // like ground level and water level, we keep a cache of it.
+  // turns out it is MUCH faster :D
+  WorldXYData xy_data;
+  if (!get_world_xy_cache(b, &xy_data)) {
+    xy_data = generate_xy_data(b.x, b.y);
+    set_world_xy_cache(b, xy_data);
+  }
+  return xy_data;
+}
 
-  return BLOCKTYPE_AIR;
+static BlockType generate_blocktype(Block b) {
+  return generate_blocktype(b, get_world_xy_data(b));
 }
 
 // WARNING: only call this if you explicitly want to bypass the cache, otherwise use get_blocktype
@@ -2588,6 +3996,14 @@ static BlockType calc_blocktype(Block b) {
   return generate_blocktype(b);
 }
 
+// same as calc_blocktype(Block), but with the xy data already looked up. When you go through a whole column of
+// blocks, get it once with get_world_xy_data instead of once per block
+static BlockType calc_blocktype(Block b, const WorldXYData &xy_data) {
+  if (b.z <= 0)
+    return BLOCKTYPE_BEDROCK;
+  return generate_blocktype(b, xy_data);
+}
+
 static BlockType get_blocktype(Block b) {
   bool in_range = is_block_in_range(b);
   if (!in_range)
@@ -2598,10 +4014,9 @@ static BlockType get_blocktype(Block b) {
   if (t != BLOCKTYPE_NULL)
     return t;
 
-  // update cache if not there
-  t = calc_blocktype(b);
-  set_blocktype_cache(b, t);
-  return t;
+  // if it isn't loaded yet we calculate it, but leave it to the block loader to put it in the cache, since only
+  // one thread can write to a section at a time (see @seqlock)
+  return calc_blocktype(b);
 }
 
 static Block get_adjacent_block(Block b, Direction dir) {
@@ -2622,6 +4037,13 @@ static bool operator==(Block a, Block b) {
   return a.x == b.x && a.y == b.y && a.z == b.z;
 }
 
+// whether the section that block b is in is loaded or retained, or will be once the block loader has done its jobs.
+// Main thread only, see @residency
+static bool section_is_resident(Block b) {
+  const Section *s = get_section(block_to_blockindex(b));
+  return s->residency != SECTION_UNLOADED && s->resident == Block{b.x & ~(SECTION_SIZE-1), b.y & ~(SECTION_SIZE-1), b.z & ~(SECTION_SIZE-1)};
+}
+
 static void push_blockdiff(Block b, BlockType t) {
   // TODO: have some good way of doing this.
   // for example we could have a dirty flag for blocks in scope
@@ -2639,188 +4061,1699 @@ static void push_blockdiff(Block b, BlockType t) {
   // // otherwise add
   // array_push(state.block_changes, {b, t});
   // update cache
+  Section *s = get_section(block_to_blockindex(b));
+  section_write_begin(s);
   set_blocktype_cache(b, t);
+  section_write_end(s);
 }
 
 
-static void remove_blockface(Block b, BlockType type, Direction d) {
-  int *vertex_pos = get_block_vertex_pos(b, d);
-  if (!vertex_pos)
-    return;
-
-  const bool transparent = blocktype_is_transparent(type);
-  Array<WorldObjectVertex> &block_vertices = transparent ? state.transparent_block_vertices : state.block_vertices;
-  Array<int> &free_faces = transparent ? state.free_transparent_faces : state.free_faces;
-
-  if ((int)*vertex_pos >= block_vertices.size) {
-    debug(die("Something went very wrong. vertex_pos was %i, but block_vertices has size %i (transparent: %i)", (int)*vertex_pos, (int)block_vertices.size, (int)transparent));
-    return;
+// which bucket the face is in, or 0 if it isn't shown
+static BlockMesh* get_block_face_mesh(BlockIndex b, Direction d, int *slot_out) {
+  const int slot = get_block_face_slot(b, d);
+  *slot_out = slot;
+  if (slot == -1)
+    return 0;
+  const u32 key = block_face_key(b, d);
+  const int slab = block_mesh_slab(b, d);
+  for (int t = 0; t < 2; ++t) {
+    BlockMesh &m = state.block_meshes[t][d][slab];
+    if (slot < block_mesh_num_faces(m) && m.face_keys[slot] == key)
+      return &m;
   }
-
-  array_push(free_faces, *vertex_pos);
-  array_zero(block_vertices, *vertex_pos*4, 4);
-  remove_block_vertex_pos(vertex_pos);
-  debug(if (get_block_vertex_pos(b, d)) die("block face (%i %i %i %i) still exists! it has value %i for key %i", b.x, b.y, b.z, (int)d, *get_block_vertex_pos(b, d), block_vertex_pos_index(block_to_blockindex(b), d)));
-
-  if (transparent) state.transparent_block_vertices_dirty = true;
-  else state.block_vertices_dirty = true;
+  die("Something went very wrong. Block face (%i %i %i %i) has slot %i, but isn't in any block mesh", b.x, b.y, b.z, (int)d, slot);
+  return 0;
 }
 
-static void show_block_faces(Block b, BlockType t) {
-  if (t == BLOCKTYPE_AIR)
+static void remove_blockface(BlockIndex b, Direction d) {
+  if (get_block_face_slot(b, d) == -1)
     return;
+  int slot;
+  BlockMesh *mesh = get_block_face_mesh(b, d, &slot);
 
-  // draw sides that face transparent blocks
-  for (int d = 0; d < DIRECTION_MAX; ++d) {
-    BlockType tt = get_blocktype(get_adjacent_block(b, (Direction)d));
-    if (!blocktype_is_transparent(tt))
-      continue;
-    // we don't want to draw water against water
-    if (t == BLOCKTYPE_WATER && tt == BLOCKTYPE_WATER)
-      continue;
+  block_mesh_free_face(*mesh, slot);
+  remove_block_face_slot(b, d);
+  debug(if (get_block_face_slot(b, d) != -1) die("block face (%i %i %i %i) still exists! it has value %i", b.x, b.y, b.z, (int)d, get_block_face_slot(b, d)));
+}
 
-    push_block_face(b, t, (Direction)d);
-  }
-  state.block_vertices_dirty = true;
+static bool block_face_is_visible(BlockType t, BlockType adjacent) {
+  if (t == BLOCKTYPE_NULL || t == BLOCKTYPE_AIR)
+    return false;
+  // draw sides that face transparent blocks
+  if (!blocktype_is_transparent(adjacent))
+    return false;
+  // we don't want to draw water against water
+  if (t == BLOCKTYPE_WATER && adjacent == BLOCKTYPE_WATER)
+    return false;
+  return true;
 }
 
-static void hide_block_faces(Block b, BlockType t) {
-  if (t == BLOCKTYPE_AIR)
-    return;
-  for (int d = 0; d < DIRECTION_MAX; ++d)
-    remove_blockface(b, t, (Direction)d);
+static bool range_contains(const BlockRange &r, Block b) {
+  return
+    b.x >= r.a.x && b.x <= r.b.x &&
+    b.y >= r.a.y && b.y <= r.b.y &&
+    b.z >= r.a.z && b.z <= r.b.z;
 }
 
-// hide the faces of the adjacent blocks that no longer can be seen
-static void hide_block_faces_of_adjacent_blocks(Block b, BlockType t) {
-  // special case for water: if it is water, we only want to hide other water blocks
-  if (t == BLOCKTYPE_WATER) {
-    for (int d = 0; d < DIRECTION_MAX; ++d) {
-      Block adj = get_adjacent_block(b, (Direction)d);
-      BlockType tt = get_blocktype(adj);
-      if (tt == BLOCKTYPE_WATER)
-        remove_blockface(adj, tt, invert_direction((Direction)d));
-    }
-  }
-  // if it is transparent, we want to keep all adjacent block faces
-  else if (!blocktype_is_transparent(t)) {
-    for (int d = 0; d < DIRECTION_MAX; ++d) {
-      Block adj = get_adjacent_block(b, (Direction)d);
-      BlockType tt = get_blocktype(adj);
-      remove_blockface(adj, tt, invert_direction((Direction)d));
-    }
-  }
-  state.block_vertices_dirty = true;
+static bool range_contains(const BlockRange &r, const BlockRange &inner) {
+  return range_contains(r, inner.a) && range_contains(r, inner.b);
 }
 
-static void show_block_faces_of_adjacent_blocks(Block b, BlockType t) {
-  // and add the newly visible faces of the adjacent blocks
-  if (!blocktype_is_transparent(t) || t == BLOCKTYPE_WATER) {
-    for (int d = 0; d < DIRECTION_MAX; ++d) {
-      Block adj = get_adjacent_block(b, (Direction)d);
+// the blocks that are in both a and b. Returns false if there are none
+static bool range_intersect(const BlockRange &a, const BlockRange &b, BlockRange *out) {
+  *out = {
+    {max(a.a.x, b.a.x), max(a.a.y, b.a.y), max(a.a.z, b.a.z)},
+    {min(a.b.x, b.b.x), min(a.b.y, b.b.y), min(a.b.z, b.b.z)}
+  };
+  return out->a.x <= out->b.x && out->a.y <= out->b.y && out->a.z <= out->b.z;
+}
 
-      BlockType tt = get_blocktype(adj);
-      if (tt == BLOCKTYPE_AIR)
-        continue;
-      push_block_face(adj, tt, invert_direction((Direction)d));
-    }
-  }
+// if a and b together make up a box, grow a to cover b too
+static bool range_merge(BlockRange *a, const BlockRange &b) {
+  const int same_x = a->a.x == b.a.x && a->b.x == b.b.x;
+  const int same_y = a->a.y == b.a.y && a->b.y == b.b.y;
+  const int same_z = a->a.z == b.a.z && a->b.z == b.b.z;
+  if (same_x + same_y + same_z < 2)
+    return false;
+  // they must touch or overlap along the last axis
+  if (b.a.x > a->b.x+1 || a->a.x > b.b.x+1 || b.a.y > a->b.y+1 || a->a.y > b.b.y+1 || b.a.z > a->b.z+1 || a->a.z > b.b.z+1)
+    return false;
+  *a = {
+    {min(a->a.x, b.a.x), min(a->a.y, b.a.y), min(a->a.z, b.a.z)},
+    {max(a->b.x, b.b.x), max(a->b.y, b.b.y), max(a->b.z, b.b.z)}
+  };
+  return true;
 }
 
-static void remove_block(Block b, BlockType t) {
-  show_block_faces_of_adjacent_blocks(b, t);
-  hide_block_faces(b, t);
-  push_blockdiff(b, BLOCKTYPE_AIR);
+// the block in range that is cached at b, given the bottom corner of the range. If the cache slot belongs to
+// a block that is not in range (for example one that is about to be unloaded), this returns a block outside of the range
+static Block blockindex_to_block(BlockIndex b, Block a = range_get_bottom(pos_to_block(state.player.pos))) {
+  return {
+    a.x + ((b.x - a.x) & (state.world.num_blocks_xy-1)),
+    a.y + ((b.y - a.y) & (state.world.num_blocks_xy-1)),
+    a.z + ((b.z - a.z) & (NUM_BLOCKS_z-1)),
+  };
 }
 
-static void set_blocktype(Block b, BlockType new_type) {
-  // this code might manipulate blocks in the world, so we need to lock on state.blocks_lock
-  // so we don't collide with the blockloader thread :)
-  SDL_AtomicLock(&state.block_loader.lock);
+// where in the world the section at a place in the block cache is. A section can stick out of the low end of the
+// range, so it isn't always the first place after range.a
+static Block section_origin(BlockIndex section, const BlockRange &range) {
+  return blockindex_to_block(section, range.a - v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1});
+}
 
-  assert(new_type != BLOCKTYPE_NULL);
+// @remesh
+// Faces are not built when blocks change. Instead the block loader and block edits mark the changed blocks
+// (plus their neighbours, whose faces might be affected) as dirty in their section, and the main thread
+// rebuilds the faces of the dirty sections a few at a time, see update_remesh.
 
-  if (new_type == BLOCKTYPE_AIR) {
-    remove_block(b, get_blocktype(b));
-    printf("Setting block (%i %i %i) to air\n", b.x, b.y, b.z);
-  } else {
-    // if converting from one blocktype to another, then always convert to air first, and then to new_type. for simplicity
-    BlockType old_type = get_blocktype(b);
-    if (old_type != BLOCKTYPE_AIR)
-      remove_block(b, old_type);
+STATIC_ASSERT(64 % SECTION_SIZE == 0, section_z_rows_fit_in_u64);
 
-    push_blockdiff(b, new_type);
+// how much farther away sections outside the view count as, see section_priority
+#define SECTION_OUTSIDE_VIEW_PRIORITY 4.0f
 
-    hide_block_faces_of_adjacent_blocks(b, new_type);
-    show_block_faces(b, new_type);
+// The view as section_priority sees it: a cone around the look direction that reaches the corners of the screen.
+// Figured out once per frame, since section_priority is called for every queued section
+struct SectionView {
+  v3 pos;
+  v3 forward;
+  float cos_angle, sin_angle;
+};
 
-    debug_verbose(
-      printf("(%i %i %i)\n", b.x, b.y, b.z);
-      for (int d = 0; d < DIRECTION_MAX; ++d) {
-        int *vpos = get_block_vertex_pos(b, (Direction)d);
-        printf("vertex pos: %i\n", vpos ? *vpos : -1);
-      }
-    );
+static SectionView section_view() {
+  // fov is the horizontal field of view, see camera_projection_matrix
+  const float angle = atanf(tanf(state.fov/2.0f)*sqrtf(1.0f + state.screen_ratio*state.screen_ratio));
+  return {state.camera_pos, camera_forward_fly(&state.camera, 1.0f), cosf(angle), sinf(angle)};
+}
+
+// How soon the section containing block b should be loaded and meshed, lower is sooner.
+// It's the squared distance from the camera, but sections outside the view count as SECTION_OUTSIDE_VIEW_PRIORITY
+// times farther away, so that what is in front of you shows up first, and what is right behind you soon after.
+// This is called for every queued section every frame, so keep it cheap
+static float section_priority(Block b, const SectionView &view) {
+  const Block origin = {b.x & ~(SECTION_SIZE-1), b.y & ~(SECTION_SIZE-1), b.z & ~(SECTION_SIZE-1)};
+  const v3 d = v3{(float)origin.x, (float)origin.y, (float)origin.z} + v3{SECTION_SIZE/2, SECTION_SIZE/2, SECTION_SIZE/2} - view.pos;
+  const float distsq = lensq(d);
+
+  // The section is in view if its bounding sphere touches the cone, that is if the angle to it is less than the
+  // angle of the cone plus the angle the sphere covers. Compared as cosines (times the distance), so we don't need
+  // any trigonometry here
+  const float radius = SECTION_SIZE*0.87f;
+  if (distsq <= radius*radius)
+    return distsq;
+  if (d*view.forward < view.cos_angle*sqrtf(distsq - radius*radius) - view.sin_angle*radius)
+    return distsq*(SECTION_OUTSIDE_VIEW_PRIORITY*SECTION_OUTSIDE_VIEW_PRIORITY);
+  return distsq;
+}
+
+// queue the blocks in r (inclusive, world coordinates) for remeshing
+static void request_remesh(BlockRange r, bool edit) {
+  for (int sx = r.a.x >> SECTION_SIZE_BITS; sx <= r.b.x >> SECTION_SIZE_BITS; ++sx)
+  for (int sy = r.a.y >> SECTION_SIZE_BITS; sy <= r.b.y >> SECTION_SIZE_BITS; ++sy)
+  for (int sz = r.a.z >> SECTION_SIZE_BITS; sz <= r.b.z >> SECTION_SIZE_BITS; ++sz) {
+    const Block origin = {sx*SECTION_SIZE, sy*SECTION_SIZE, sz*SECTION_SIZE};
+    const BlockIndex bi = block_to_blockindex(origin);
+    Section *s = get_section(bi);
+    if (s->residency == SECTION_RETAINED && s->resident == origin)
+      s->retained_remesh = true;
+
+    if (!s->dirty_blocks) {
+      s->dirty_blocks = (u64*)calloc(SECTION_NUM_BLOCKS/64, sizeof(*s->dirty_blocks));
+      if (!s->dirty_blocks)
+        die("Failed to allocate dirty blocks for section");
+      s->remesh_edit = false;
+      array_push(state.remesh.queue, bi);
+    }
+    s->remesh_edit |= edit;
+
+    // the part of r that is inside this section
+    const v3i a = {max(r.a.x - origin.x, 0), max(r.a.y - origin.y, 0), max(r.a.z - origin.z, 0)};
+    const v3i b = {min(r.b.x - origin.x, SECTION_SIZE-1), min(r.b.y - origin.y, SECTION_SIZE-1), min(r.b.z - origin.z, SECTION_SIZE-1)};
+    const u64 zmask = (((u64)1 << (b.z - a.z + 1)) - 1) << a.z;
+    for (int x = a.x; x <= b.x; ++x)
+    for (int y = a.y; y <= b.y; ++y) {
+      const int i = (x*SECTION_SIZE + y)*SECTION_SIZE;
+      s->dirty_blocks[i/64] |= zmask << (i%64);
+    }
   }
-
-  SDL_AtomicUnlock(&state.block_loader.lock);
 }
 
-static void push_block_loader_command(BlockLoaderCommand command) {
-  #if 0
-  BlockRange r = command.range;
-  if (command.type == BlockLoaderCommand::LOAD_BLOCK) {
-    for (int x = r.a.x; x <= r.b.x; ++x)
-    for (int y = r.a.y; y <= r.b.y; ++y)
-    for (int z = r.a.z; z <= r.b.z; ++z)
-      show_block_faces({x,y,z}, false);
-  } else {
-    assert(command.type == BlockLoaderCommand::UNLOAD_BLOCK);
-    for (int x = r.a.x; x <= r.b.x; ++x)
-    for (int y = r.a.y; y <= r.b.y; ++y)
-    for (int z = r.a.z; z <= r.b.z; ++z)
-      unload_block({x,y,z}, false);
+// called by the block loader when it has changed the blocks in r
+static void block_loader_request_remesh(BlockRange r) {
+  // the faces of the blocks next to r might change too
+  r.a = r.a - v3i{1,1,1};
+  r.b = r.b + v3i{1,1,1};
+  spin_lock(&state.block_loader.remesh_lock);
+  array_push(state.block_loader.remesh_requests, r);
+  spin_unlock(&state.block_loader.remesh_lock);
+}
+
+// show or hide a block face. Faces that are still shown keep their slot, and their vertices are only
+// written to if they changed, so that we only have to send the changed parts of the block meshes to the gpu
+// show the face with the vertices v, or hide it if v is NULL
+static void set_block_face(BlockIndex bi, BlockType t, Direction dir, const WorldObjectVertex *v) {
+  int slot;
+  BlockMesh *mesh = get_block_face_mesh(bi, dir, &slot);
+  if (!v) {
+    if (mesh)
+      remove_blockface(bi, dir);
+    return;
   }
 
-  #else
-  if (SDL_SemWait(state.block_loader.num_commands_free))
-    sdl_die("Semaphore failure");
+  // moved between the opaque and transparent mesh
+  if (mesh && mesh != &get_block_mesh(t, bi, dir)) {
+    remove_blockface(bi, dir);
+    mesh = 0;
+  }
 
-  int head = state.block_loader.commands_head;
-  state.block_loader.commands[head] = command;
-  state.block_loader.commands_head = (head + 1) & (MAX_BLOCK_LOADER_COMMANDS-1);
+  if (!mesh) {
+    push_block_face_vertices(bi, t, dir, v);
+    return;
+  }
 
-  if (SDL_SemPost(state.block_loader.num_commands))
-    sdl_die("Semaphore failure");
-  #endif
+  // the block type or the blocks around it might have changed, or the cache slot is now used by another block
+  if (memcmp(v, &mesh->vertices[slot*4], 4*sizeof(*v))) {
+    memcpy(&mesh->vertices[slot*4], v, 4*sizeof(*v));
+    block_mesh_touch(*mesh, slot);
+  }
 }
 
-static BlockLoaderCommand pop_block_loader_command() {
-  if (SDL_SemWait(state.block_loader.num_commands))
-    sdl_die("Semaphore failure");
-
-  int tail = state.block_loader.commands_tail;
-  BlockLoaderCommand command = state.block_loader.commands[tail];
-  state.block_loader.commands_tail = (tail + 1) & (MAX_BLOCK_LOADER_COMMANDS-1);
+static void update_block_face(BlockIndex bi, Block block, BlockType t, Direction dir, bool visible, BlockOcclusion occluders) {
+  WorldObjectVertex v[4];
+  if (visible)
+    block_face_vertices(block, t, dir, occluders, v);
+  set_block_face(bi, t, dir, visible ? v : NULL);
+}
 
-  if (SDL_SemPost(state.block_loader.num_commands_free))
-    sdl_die("Semaphore failure");
-  return command;
+// the type remesh_section uses for a block in the section. Blocks that are not loaded (or are on their way out) don't have any faces
+static BlockType remesh_blocktype(BlockIndex bi, Block block, const BlockRange &range) {
+  if (!range_contains(range, block))
+    return BLOCKTYPE_NULL;
+  return get_blocktype_cache(bi);
 }
 
-/* in: line, plane, plane origin */
-static bool collision_plane(v3 x0, v3 x1, v3 p0, v3 p1, v3 p2, float *t_out, v3 *n_out) {
-  float d, t,u,v;
-  v3 n, dx;
+// the type remesh_section uses for a block next to a block in the section. Same as get_blocktype, but we already know the range
+static BlockType remesh_adjacent_blocktype(Block adj, const BlockRange &range) {
+  BlockType t = range_contains(range, adj) ? get_blocktype_cache(adj) : BLOCKTYPE_NULL;
+  if (t == BLOCKTYPE_NULL)
+    t = get_blocktype(adj);
+  return t;
+}
 
-  dx = x1-x0;
+static BlockOcclusion remesh_block_occlusion(Block block, const BlockRange &range) {
+  BlockOcclusion o = 0;
+  for (int x = -1; x <= 1; ++x)
+  for (int y = -1; y <= 1; ++y)
+  for (int z = -1; z <= 1; ++z)
+    if ((x || y || z) && blocktype_occludes(remesh_adjacent_blocktype(block + v3i{x,y,z}, range)))
+      o |= block_occlusion_bit(x, y, z);
+  return o;
+}
 
-  p1 = p1 - p0;
-  p2 = p2 - p0;
+static bool section_is_all_dirty(const Section *s) {
+  for (int i = 0; i < SECTION_NUM_BLOCKS/64; ++i)
+    if (s->dirty_blocks[i] != UINT64_MAX)
+      return false;
+  return true;
+}
 
-  n = cross(p1, p2);
+// the blocks of a section and the blocks around it, which is everything that decides which faces of the section are shown
+// and how occluded they are (see @ao). Indexed [x+1][y+1][z+1] in section local coordinates
+struct SectionBlocks {
+  u8 types[SECTION_SIZE+2][SECTION_SIZE+2][SECTION_SIZE+2];
+  bool has_faces; // false if all blocks in the section are air or not loaded
+  // the section sticks out of the range. The blocks outside of it are only there as neighbours, and have no faces
+  bool partial;
+};
 
-  d = dx*n;
+static void gather_section_blocks(BlockIndex section, const BlockRange &range, SectionBlocks *out) {
+  memset(out, 0, sizeof(*out));
+  const Block origin = section_origin(section, range);
+
+  // if all of the section is in range we can just copy it from the cache
+  if (range_contains(range, origin) && range_contains(range, origin + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1})) {
+    Section *s = get_section(section);
+    int version;
+    do {
+      version = section_read_begin(s);
+      for (int x = 0; x < SECTION_SIZE; ++x)
+      for (int y = 0; y < SECTION_SIZE; ++y)
+        memcpy(&out->types[x+1][y+1][1], get_block_cache({section.x + x, section.y + y, section.z}), SECTION_SIZE);
+    } while (!section_read_end(s, version));
+  } else {
+    // the blocks in range come from the cache like above, so the ones that are not loaded (see @loadarea) have no faces
+    out->partial = true;
+    for (int x = 0; x < SECTION_SIZE; ++x)
+    for (int y = 0; y < SECTION_SIZE; ++y)
+    for (int z = 0; z < SECTION_SIZE; ++z) {
+      const Block b = origin + v3i{x,y,z};
+      out->types[x+1][y+1][z+1] = (u8)(range_contains(range, b) ? get_blocktype_cache(b) : remesh_adjacent_blocktype(b, range));
+    }
+  }
+
+  for (int x = 0; x < SECTION_SIZE; ++x)
+  for (int y = 0; y < SECTION_SIZE; ++y)
+  for (int z = 0; z < SECTION_SIZE; ++z) {
+    const BlockType t = (BlockType)out->types[x+1][y+1][z+1];
+    if (out->partial && !range_contains(range, origin + v3i{x,y,z}))
+      continue;
+    out->has_faces |= t != BLOCKTYPE_NULL && t != BLOCKTYPE_AIR;
+  }
+
+  // the shell around the section. The sides decide which faces are shown, and the edges and corners are only for occlusion
+  for (int x = -1; x <= SECTION_SIZE; ++x)
+  for (int y = -1; y <= SECTION_SIZE; ++y)
+  for (int z = -1; z <= SECTION_SIZE; ++z) {
+    const bool inside_xy = x >= 0 && x < SECTION_SIZE && y >= 0 && y < SECTION_SIZE;
+    // jump over the inside of the section
+    if (inside_xy && z == 0)
+      z = SECTION_SIZE;
+    out->types[x+1][y+1][z+1] = (u8)remesh_adjacent_blocktype(origin + v3i{x,y,z}, range);
+  }
+}
+
+static BlockOcclusion section_blocks_occlusion(const SectionBlocks &blocks, int x, int y, int z) {
+  BlockOcclusion o = 0;
+  for (int i = -1; i <= 1; ++i)
+  for (int j = -1; j <= 1; ++j)
+  for (int k = -1; k <= 1; ++k)
+    if (blocktype_occludes((BlockType)blocks.types[x+1+i][y+1+j][z+1+k]))
+      o |= block_occlusion_bit(i, j, k);
+  return o;
+}
+
+static BlockType section_blocks_adjacent(const SectionBlocks &blocks, int x, int y, int z, Direction dir) {
+  switch (dir) {
+    case DIRECTION_UP:      return (BlockType)blocks.types[x+1][y+1][z+2];
+    case DIRECTION_DOWN:    return (BlockType)blocks.types[x+1][y+1][z];
+    case DIRECTION_X:       return (BlockType)blocks.types[x+2][y+1][z+1];
+    case DIRECTION_Y:       return (BlockType)blocks.types[x+1][y+2][z+1];
+    case DIRECTION_MINUS_X: return (BlockType)blocks.types[x][y+1][z+1];
+    case DIRECTION_MINUS_Y: return (BlockType)blocks.types[x+1][y][z+1];
+    default:
+      die("Invalid direction %i", (int)dir);
+      return BLOCKTYPE_NULL;
+  }
+}
+
+// @meshcache
+// The finished faces of a section are saved to disk, keyed by a hash of its SectionBlocks, so that when we come back
+// to a place we have already been (or start the game again), we can skip figuring out which faces are shown and
+// making their vertices and ambient occlusion: an entry has the faces and their vertices, ready to be copied into the meshes.
+// Vertices are stored relative to the section, so sections that look the same (like all the bedrock ones) share an entry.
+// We only use it when a whole section is remeshed, which is what happens at startup and when sections are loaded
+// in bulk, since the cached faces replace all faces of the section.
+// It lives in the cache directory of the user (see mine_cache_dir), and is kept under a budget (see mesh_cache_evict)
+#define DEFAULT_MESH_CACHE_BUDGET 256 // in MB
+#define MESH_CACHE_MAX_PENDING (64 << 20) // entries waiting to be written, in bytes. Past this we don't save new ones
+#define MESH_CACHE_DISK_BLOCK 4096 // a file takes up a whole number of these on disk, however small it is
+#define MESH_CACHE_MAGIC 0x4d434d43 // "MCMC"
+#define MESH_CACHE_VERSION 2
+
+// followed by num_faces MeshCacheFaces, in order, and then 4 WorldObjectVertex for each of them
+struct MeshCacheHeader {
+  u32 magic;
+  u32 version;
+  u64 hash;
+  u32 num_faces;
+};
+
+// a face in the cache, section_block_index(block) << 3 | direction
+typedef u16 MeshCacheFace;
+#define MESH_CACHE_FACE_MAX (SECTION_NUM_BLOCKS << 3)
+STATIC_ASSERT(MESH_CACHE_FACE_MAX <= UINT16_MAX + 1, mesh_cache_faces_fit_in_u16);
+
+static u64 mesh_cache_disk_size(u64 file_size) {
+  return (file_size + MESH_CACHE_DISK_BLOCK - 1) / MESH_CACHE_DISK_BLOCK * MESH_CACHE_DISK_BLOCK;
+}
+
+static int file_info_modified_cmp(const void *a, const void *b) {
+  const u64 ma = ((const FileInfo*)a)->modified;
+  const u64 mb = ((const FileInfo*)b)->modified;
+  return ma < mb ? -1 : ma > mb;
+}
+
+// Remove the least recently used entries until the cache takes up at most target bytes. The writer thread touches the
+// entries we use, so the least recently used ones are the ones modified the longest ago, also from earlier runs.
+// It has to list the whole directory, so it goes well below the budget when it is over it (see mesh_cache_write),
+// to not come back here for a while. Writer thread only
+static void mesh_cache_evict(u64 target) {
+  Array<FileInfo> files = {};
+  mine_list_files(state.mesh_cache.dir, files);
+  u64 size = 0;
+  int evicted = 0;
+  For(files)
+    size += mesh_cache_disk_size(it->size);
+  if (size > target) {
+    qsort(files.items, files.size, sizeof(*files.items), file_info_modified_cmp);
+    for (int i = 0; i < files.size && size > target; ++i) {
+      char path[MINE_PATH_MAX];
+      snprintf(path, sizeof(path), "%s/%s", state.mesh_cache.dir, files[i].name);
+      if (remove(path))
+        continue;
+      size -= mesh_cache_disk_size(files[i].size);
+      ++evicted;
+    }
+  }
+  state.mesh_cache.size = size;
+  array_free(files);
+  spin_lock(&state.mesh_cache.lock);
+  state.mesh_cache.evicted += evicted;
+  spin_unlock(&state.mesh_cache.lock);
+}
+
+// 64 bit FNV-1a. Start with h = FNV1A_START, and pass the result back in to hash more data
+#define FNV1A_START 14695981039346656037ULL
+static u64 fnv1a(u64 h, const void *data, int size) {
+  const u8 *p = (const u8*)data;
+  for (int i = 0; i < size; ++i)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+static u64 hash_section_blocks(const SectionBlocks &blocks) {
+  return fnv1a(FNV1A_START, blocks.types, sizeof(blocks.types));
+}
+
+static void mesh_cache_filename(u64 hash, char out[MINE_PATH_MAX]) {
+  snprintf(out, MINE_PATH_MAX, "%s/%016llx.mesh", state.mesh_cache.dir, (unsigned long long)hash);
+}
+
+#define MESH_CACHE_MISSING -1
+#define MESH_CACHE_BAD -2 // the entry is old or broken, and will be overwritten
+
+// returns the number of faces, or MESH_CACHE_MISSING or MESH_CACHE_BAD. Safe to call from any thread
+static int mesh_cache_load(u64 hash, MeshCacheFace faces[SECTION_NUM_FACES], Array<WorldObjectVertex> &vertices) {
+  char filename[MINE_PATH_MAX];
+  mesh_cache_filename(hash, filename);
+  FILE *f = mine_fopen(filename, "rb");
+  if (!f)
+    return MESH_CACHE_MISSING;
+
+  MeshCacheHeader header;
+  bool ok =
+    fread(&header, sizeof(header), 1, f) == 1 &&
+    header.magic == MESH_CACHE_MAGIC &&
+    header.version == MESH_CACHE_VERSION &&
+    header.hash == hash &&
+    header.num_faces <= SECTION_NUM_FACES &&
+    fread(faces, sizeof(*faces), header.num_faces, f) == header.num_faces;
+  if (ok) {
+    array_resize(vertices, header.num_faces*4);
+    ok = fread(vertices.items, sizeof(*vertices.items), vertices.size, f) == (size_t)vertices.size;
+  }
+  fclose(f);
+  // finish_section_remesh goes through the faces in order
+  for (int i = 0; ok && i < (int)header.num_faces; ++i)
+    ok = faces[i] < MESH_CACHE_FACE_MAX && (faces[i] & 7) < DIRECTION_MAX && (i == 0 || faces[i] > faces[i-1]);
+  for (int i = 0; ok && i < vertices.size; ++i) {
+    const v3 p = vertices[i].pos;
+    ok = p.x >= 0.0f && p.x <= SECTION_SIZE && p.y >= 0.0f && p.y <= SECTION_SIZE && p.z >= 0.0f && p.z <= SECTION_SIZE;
+  }
+
+  return ok ? (int)header.num_faces : MESH_CACHE_BAD;
+}
+
+static int mesh_cache_entry_size(int num_faces) {
+  return (int)(sizeof(MeshCacheHeader) + num_faces*(sizeof(MeshCacheFace) + 4*sizeof(WorldObjectVertex)));
+}
+
+// The cache is just an optimization, so if we fail to write we don't care.
+// The entry is written to a temporary file first and then moved into place, so another run of the game (or this one,
+// if we crash halfway) never reads half an entry. Writer thread only
+static void mesh_cache_write(const u8 *entry) {
+  const MeshCacheHeader &header = *(const MeshCacheHeader*)entry;
+  const int size = mesh_cache_entry_size(header.num_faces);
+  char filename[MINE_PATH_MAX], temp[MINE_PATH_MAX + 16];
+  mesh_cache_filename(header.hash, filename);
+  snprintf(temp, sizeof(temp), "%s.%u.tmp", filename, mine_process_id());
+  FILE *f = mine_fopen(temp, "wb");
+  if (!f)
+    return;
+  bool ok = fwrite(entry, size, 1, f) == 1;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || !mine_rename_replace(temp, filename)) {
+    remove(temp);
+    return;
+  }
+
+  state.mesh_cache.size += mesh_cache_disk_size(size);
+  if (state.mesh_cache.size > state.mesh_cache.budget)
+    mesh_cache_evict(state.mesh_cache.budget/4*3);
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  const u64 x = *(const u64*)a, y = *(const u64*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Does all of the disk work of the cache except loading entries (which the task workers do, see prepare_section_remesh):
+// writing new entries, marking the ones we used as recently used, and eviction, so the main thread never waits for the disk.
+// It takes everything that is queued at once, and touches each entry once however many sections used it
+static int mesh_cache_writer_thread(void*) {
+  // the budget might be smaller than last time. mesh_cache_init set writing for this
+  mesh_cache_evict(state.mesh_cache.budget);
+  Array<u8*> writes = {};
+  Array<u64> touched = {};
+  for (;;) {
+    spin_lock(&state.mesh_cache.lock);
+    state.mesh_cache.writing = false;
+    spin_unlock(&state.mesh_cache.lock);
+    semaphore_wait(state.mesh_cache.wakeup);
+
+    spin_lock(&state.mesh_cache.lock);
+    swap(writes, state.mesh_cache.writes);
+    swap(touched, state.mesh_cache.touched);
+    state.mesh_cache.writing = true;
+    spin_unlock(&state.mesh_cache.lock);
+
+    if (touched.size)
+      qsort(touched.items, touched.size, sizeof(*touched.items), u64_cmp);
+    for (int i = 0; i < touched.size; ++i) {
+      if (i && touched[i] == touched[i-1])
+        continue;
+      char filename[MINE_PATH_MAX];
+      mesh_cache_filename(touched[i], filename);
+      mine_touch(filename);
+    }
+    touched.size = 0;
+
+    u64 written = 0;
+    For(writes) {
+      mesh_cache_write(*it);
+      written += mesh_cache_entry_size(((MeshCacheHeader*)*it)->num_faces);
+      free(*it);
+    }
+    writes.size = 0;
+    spin_lock(&state.mesh_cache.lock);
+    state.mesh_cache.pending -= written;
+    spin_unlock(&state.mesh_cache.lock);
+  }
+}
+
+// hand the writer thread what it needs to do. Call with state.mesh_cache.lock held
+static void mesh_cache_wake_writer(bool was_idle) {
+  if (was_idle)
+    semaphore_post(state.mesh_cache.wakeup);
+}
+
+// Copies the entry and queues it for the writer thread. If the disk can't keep up, we don't save it
+static void mesh_cache_save(u64 hash, const MeshCacheFace faces[], int num_faces, const WorldObjectVertex vertices[]) {
+  const int size = mesh_cache_entry_size(num_faces);
+  spin_lock(&state.mesh_cache.lock);
+  const bool full = state.mesh_cache.pending + size > MESH_CACHE_MAX_PENDING;
+  if (full)
+    ++state.mesh_cache.dropped;
+  else
+    state.mesh_cache.pending += size;
+  spin_unlock(&state.mesh_cache.lock);
+  if (full)
+    return;
+
+  u8 *entry = (u8*)malloc(size);
+  if (!entry)
+    die("Out of memory");
+  const MeshCacheHeader header = {MESH_CACHE_MAGIC, MESH_CACHE_VERSION, hash, (u32)num_faces};
+  memcpy(entry, &header, sizeof(header));
+  // vertices is null if there are no faces
+  if (num_faces) {
+    memcpy(entry + sizeof(header), faces, num_faces*sizeof(*faces));
+    memcpy(entry + sizeof(header) + num_faces*sizeof(*faces), vertices, num_faces*4*sizeof(*vertices));
+  }
+
+  spin_lock(&state.mesh_cache.lock);
+  const bool was_idle = !state.mesh_cache.writes.size && !state.mesh_cache.touched.size;
+  array_push(state.mesh_cache.writes, entry);
+  mesh_cache_wake_writer(was_idle);
+  spin_unlock(&state.mesh_cache.lock);
+}
+
+// the entry was used, so it is the last one to be evicted, see mesh_cache_evict
+static void mesh_cache_touch(u64 hash) {
+  spin_lock(&state.mesh_cache.lock);
+  const bool was_idle = !state.mesh_cache.writes.size && !state.mesh_cache.touched.size;
+  array_push(state.mesh_cache.touched, hash);
+  mesh_cache_wake_writer(was_idle);
+  spin_unlock(&state.mesh_cache.lock);
+}
+
+// wait until the writer thread has written everything that is queued, like before we exit
+static void mesh_cache_flush() {
+  if (!state.mesh_cache.writer)
+    return;
+  for (;;) {
+    spin_lock(&state.mesh_cache.lock);
+    const bool done = !state.mesh_cache.writing && !state.mesh_cache.writes.size && !state.mesh_cache.touched.size;
+    spin_unlock(&state.mesh_cache.lock);
+    if (done)
+      return;
+    mine_sleep_ms(1);
+  }
+}
+
+static void mesh_cache_init() {
+  char dir[MINE_PATH_MAX];
+  if (!mine_cache_dir(dir) || snprintf(state.mesh_cache.dir, sizeof(state.mesh_cache.dir), "%s/mesh_cache", dir) >= (int)sizeof(state.mesh_cache.dir)) {
+    printf("Found no cache directory, so there is no mesh cache\n");
+    state.mesh_cache.enabled = false;
+    return;
+  }
+  mine_mkdir(state.mesh_cache.dir);
+  printf("mesh cache: %s, up to %llu MB\n", state.mesh_cache.dir, (unsigned long long)(state.mesh_cache.budget >> 20));
+  if (state.mesh_cache.writer)
+    return;
+  state.mesh_cache.writing = true;
+  state.mesh_cache.wakeup = semaphore_create();
+  state.mesh_cache.writer = thread_create(mesh_cache_writer_thread, 0);
+}
+
+// Rebuilding all faces of a section is split in two. prepare_section_remesh finds the faces that are shown and makes
+// their vertices, either from the mesh cache or from the blocks, which only reads the blocks, so the task workers do it
+// for many sections at once. Then finish_section_remesh copies them into the meshes, on the main thread. See update_remesh
+struct SectionRemesh {
+  BlockIndex section;
+  bool loaded; // see update_remesh
+  SectionBlocks blocks;
+  bool use_cache;
+  u64 hash;
+  int cache_result; // what mesh_cache_load returned
+  int num_faces;
+  MeshCacheFace faces[SECTION_NUM_FACES]; // in the order of the blocks and then the directions, like in the cache
+  Array<WorldObjectVertex> vertices; // 4 for each face, relative to the section
+};
+
+static void prepare_section_remesh(SectionRemesh *r, const BlockRange &range) {
+  SectionBlocks &blocks = r->blocks;
+  gather_section_blocks(r->section, range, &blocks);
+  const Block origin = section_origin(r->section, range);
+
+  // if there is nothing to show there's no need to go to the cache.
+  // The cached faces are for whole sections, so sections at the edge of the range don't use it
+  r->use_cache = state.mesh_cache.enabled && blocks.has_faces && !blocks.partial;
+  r->hash = r->use_cache ? hash_section_blocks(blocks) : 0;
+  r->cache_result = r->use_cache ? mesh_cache_load(r->hash, r->faces, r->vertices) : MESH_CACHE_MISSING;
+  if (r->cache_result >= 0) {
+    r->num_faces = r->cache_result;
+    return;
+  }
+
+  r->num_faces = 0;
+  r->vertices.size = 0;
+  if (!blocks.has_faces)
+    return;
+  for (int x = 0; x < SECTION_SIZE; ++x)
+  for (int y = 0; y < SECTION_SIZE; ++y)
+  for (int z = 0; z < SECTION_SIZE; ++z) {
+    const BlockType t = (BlockType)blocks.types[x+1][y+1][z+1];
+    if (t == BLOCKTYPE_NULL || t == BLOCKTYPE_AIR || (blocks.partial && !range_contains(range, origin + v3i{x,y,z})))
+      continue;
+    const int i = section_block_index({r->section.x + x, r->section.y + y, r->section.z + z});
+    // most blocks are buried and have no faces, so we only figure out the occlusion when we need it
+    bool has_occlusion = false;
+    BlockOcclusion o = 0;
+    for (int d = 0; d < DIRECTION_MAX; ++d) {
+      if (!block_face_is_visible(t, section_blocks_adjacent(blocks, x, y, z, (Direction)d)))
+        continue;
+      if (!has_occlusion)
+        o = section_blocks_occlusion(blocks, x, y, z), has_occlusion = true;
+      r->faces[r->num_faces++] = (MeshCacheFace)(i << 3 | d);
+      block_face_vertices({x, y, z}, t, (Direction)d, o, array_pushn(r->vertices, 4));
+    }
+  }
+}
+
+static void finish_section_remesh(SectionRemesh *r, const BlockRange &range) {
+  Section *s = get_section(r->section);
+  const SectionBlocks &blocks = r->blocks;
+  const Block origin = section_origin(r->section, range);
+  const bool hit = r->cache_result >= 0;
+  if (r->use_cache)
+    ++(hit ? state.mesh_cache.hits : state.mesh_cache.misses);
+  if (hit)
+    mesh_cache_touch(r->hash);
+  if (r->cache_result == MESH_CACHE_BAD)
+    ++state.mesh_cache.bad_entries;
+  if (r->use_cache && !hit)
+    mesh_cache_save(r->hash, r->faces, r->num_faces, r->vertices.items);
+
+  // move the vertices to where the section is
+  const v3 offset = {(float)origin.x, (float)origin.y, (float)origin.z};
+  for (int i = 0; i < r->vertices.size; ++i)
+    r->vertices[i].pos = r->vertices[i].pos + offset;
+
+  // the common case when a section is loaded: it has no faces yet, so just add the new ones
+  if (!s->num_faces) {
+    for (int i = 0; i < r->num_faces; ++i) {
+      const int b = r->faces[i] >> 3;
+      const int x = b/(SECTION_SIZE*SECTION_SIZE), y = b/SECTION_SIZE%SECTION_SIZE, z = b%SECTION_SIZE;
+      const BlockType t = (BlockType)blocks.types[x+1][y+1][z+1];
+      if (t == BLOCKTYPE_NULL || t == BLOCKTYPE_AIR)
+        continue;
+      const BlockIndex bi = {r->section.x + x, r->section.y + y, r->section.z + z};
+      push_block_face_vertices(bi, t, (Direction)(r->faces[i] & 7), &r->vertices[i*4]);
+    }
+  }
+  // otherwise go through all blocks, to also hide the faces that aren't shown anymore. The faces are in the same
+  // order as the blocks and directions here (see section_block_index), so we just step through them
+  else {
+    int next = 0;
+    for (int x = 0; x < SECTION_SIZE; ++x)
+    for (int y = 0; y < SECTION_SIZE; ++y)
+    for (int z = 0; z < SECTION_SIZE; ++z) {
+      const BlockIndex bi = {r->section.x + x, r->section.y + y, r->section.z + z};
+      const int i = section_block_index(bi);
+      BlockType t = (BlockType)blocks.types[x+1][y+1][z+1];
+      if (blocks.partial && !range_contains(range, origin + v3i{x,y,z}))
+        t = BLOCKTYPE_NULL;
+      for (int d = 0; d < DIRECTION_MAX; ++d) {
+        const bool shown = next < r->num_faces && r->faces[next] == (MeshCacheFace)(i << 3 | d);
+        const bool visible = shown && t != BLOCKTYPE_NULL && t != BLOCKTYPE_AIR;
+        set_block_face(bi, t, (Direction)d, visible ? &r->vertices[next*4] : NULL);
+        next += shown;
+      }
+    }
+  }
+
+  free(s->dirty_blocks);
+  s->dirty_blocks = 0;
+  s->remesh_edit = false;
+}
+
+// Rebuild the faces of the dirty blocks of a section, when only some of them are. Sections where all of them are
+// go through prepare_section_remesh instead
+static void remesh_section(BlockIndex section) {
+  Section *s = get_section(section);
+  const BlockRange range = pos_to_range(state.player.pos);
+
+  for (int i = 0; i < SECTION_NUM_BLOCKS; ++i) {
+    // skip whole words of clean blocks
+    if (!s->dirty_blocks[i/64]) {
+      i += 63;
+      continue;
+    }
+    if (!(s->dirty_blocks[i/64] & ((u64)1 << (i%64))))
+      continue;
+
+    const BlockIndex bi = {
+      section.x + i/(SECTION_SIZE*SECTION_SIZE),
+      section.y + i/SECTION_SIZE%SECTION_SIZE,
+      section.z + i%SECTION_SIZE
+    };
+    const Block block = blockindex_to_block(bi, range.a);
+    const BlockType t = remesh_blocktype(bi, block, range);
+
+    // air doesn't have any faces, and is most blocks
+    if (t == BLOCKTYPE_NULL || t == BLOCKTYPE_AIR) {
+      if (s->num_faces)
+        for (int d = 0; d < DIRECTION_MAX; ++d)
+          remove_blockface(bi, (Direction)d);
+      continue;
+    }
+
+    bool visible[DIRECTION_MAX];
+    bool any_visible = false;
+    for (int d = 0; d < DIRECTION_MAX; ++d) {
+      const BlockType tt = remesh_adjacent_blocktype(get_adjacent_block(block, (Direction)d), range);
+      visible[d] = block_face_is_visible(t, tt);
+      any_visible |= visible[d];
+    }
+
+    // most blocks are buried, so we only look at the rest of the blocks around it if it has faces to occlude
+    const BlockOcclusion o = any_visible ? remesh_block_occlusion(block, range) : 0;
+    for (int d = 0; d < DIRECTION_MAX; ++d)
+      update_block_face(bi, block, t, (Direction)d, visible[d], o);
+  }
+
+  free(s->dirty_blocks);
+  s->dirty_blocks = 0;
+  s->remesh_edit = false;
+}
+
+struct RemeshJob {
+  BlockIndex section;
+  float priority; // lower goes first
+};
+
+// at most how many sections update_remesh does at once
+#define REMESH_MAX_BATCH 64
+
+struct RemeshBatch {
+  SectionRemesh *sections;
+  BlockRange range;
+};
+
+static void prepare_section_remeshes(void *data, int begin, int end) {
+  RemeshBatch *batch = (RemeshBatch*)data;
+  for (int i = begin; i < end; ++i)
+    prepare_section_remesh(&batch->sections[i], batch->range);
+}
+
+// Binary heaps of jobs, with the lowest priority on top. The remesh queue and the block loader jobs can be thousands
+// of sections after a teleport, and we only get to a few of them every frame, so we only pay for ordering those.
+// T needs a float priority
+template <class T>
+static void job_heap_down(Array<T> &heap, int i) {
+  for (;;) {
+    const int l = 2*i + 1, r = l + 1;
+    int first = i;
+    if (l < heap.size && heap[l].priority < heap[first].priority)
+      first = l;
+    if (r < heap.size && heap[r].priority < heap[first].priority)
+      first = r;
+    if (first == i)
+      return;
+    swap(heap[i], heap[first]);
+    i = first;
+  }
+}
+
+template <class T>
+static void job_heap_make(Array<T> &heap) {
+  for (int i = heap.size/2 - 1; i >= 0; --i)
+    job_heap_down(heap, i);
+}
+
+template <class T>
+static T job_heap_pop(Array<T> &heap) {
+  const T top = heap[0];
+  heap[0] = heap[heap.size-1];
+  --heap.size;
+  job_heap_down(heap, 0);
+  return top;
+}
+
+// Remesh dirty sections for at most budget_ms milliseconds.
+// Sections the player edited always go first and are always done this frame, so edits show up right away.
+// Then we go by section_priority, always doing at least one so we never stall.
+// Sections are done in batches of two per thread. The task workers prepare the whole sections of a batch at the same
+// time (see prepare_section_remesh), and then the main thread finishes them in order
+static void update_remesh(float budget_ms) {
+  const u64 start = mine_performance_counter();
+
+  // take the requests from the block loader
+  spin_lock(&state.block_loader.remesh_lock);
+  swap(state.remesh.requests, state.block_loader.remesh_requests);
+  spin_unlock(&state.block_loader.remesh_lock);
+  For(state.remesh.requests)
+    request_remesh(*it, false);
+  state.remesh.requests.size = 0;
+
+  state.remesh.sections_this_frame = 0;
+  if (!state.remesh.queue.size)
+    return;
+
+  // order by priority
+  const BlockRange range = pos_to_range(state.player.pos);
+  const SectionView view = section_view();
+  static Array<RemeshJob> jobs;
+  array_resize(jobs, state.remesh.queue.size);
+  for (int i = 0; i < state.remesh.queue.size; ++i) {
+    const BlockIndex bi = state.remesh.queue[i];
+    const Section *s = get_section(bi);
+    const float priority = s->remesh_edit ? -1.0f : section_priority(section_origin(bi, range), view);
+    jobs[i] = {bi, priority};
+  }
+  job_heap_make(jobs);
+
+  static Array<RemeshJob> picked;
+  static Array<SectionRemesh> batch;
+  static Array<int> prepared; // where the job is in batch, or -1 if only some of its blocks are dirty
+  const int batch_size = min(2*(state.tasks.num_workers + 1), REMESH_MAX_BATCH);
+  array_resize(picked, batch_size);
+  array_resize(prepared, batch_size);
+  if (batch.size < batch_size) {
+    // they have arrays that are kept from frame to frame
+    const int n = batch.size;
+    array_resize(batch, batch_size);
+    array_zero(batch, n, batch_size - n);
+  }
+  int done = 0;
+  while (jobs.size) {
+    if (done && jobs[0].priority >= 0.0f && (mine_performance_counter() - start) * 1000.0 / mine_performance_frequency() > budget_ms)
+      break;
+    const int n = min(jobs.size, batch_size);
+    for (int j = 0; j < n; ++j)
+      picked[j] = job_heap_pop(jobs);
+    int num_whole = 0;
+    for (int j = 0; j < n; ++j) {
+      const BlockIndex section = picked[j].section;
+      prepared[j] = -1;
+      if (!section_is_all_dirty(get_section(section)))
+        continue;
+      SectionRemesh &r = batch[num_whole];
+      r.section = section;
+      // the block loader writes all blocks of a section at once, so if one is there they all are,
+      // and prepare_section_remesh sees them
+      r.loaded = get_blocktype_cache(section) != BLOCKTYPE_NULL;
+      prepared[j] = num_whole++;
+    }
+    RemeshBatch data = {batch.items, range};
+    parallel_for(num_whole, 1, prepare_section_remeshes, &data);
+
+    for (int j = 0; j < n; ++j) {
+      const BlockIndex section = picked[j].section;
+      bool loaded;
+      if (prepared[j] != -1) {
+        finish_section_remesh(&batch[prepared[j]], range);
+        loaded = batch[prepared[j]].loaded;
+      } else {
+        loaded = get_blocktype_cache(section) != BLOCKTYPE_NULL;
+        remesh_section(section);
+      }
+      Section *s = get_section(section);
+      s->meshed = loaded;
+      // it was unloaded, and now that its faces are gone it can give back its face slots
+      if (!loaded && !s->num_faces) {
+        free(s->face_slots);
+        s->face_slots = 0;
+      }
+    }
+    done += n;
+  }
+  state.remesh.sections_this_frame = done;
+
+  // keep the rest for next frame, when they get new priorities anyway
+  state.remesh.queue.size = 0;
+  for (int i = 0; i < jobs.size; ++i)
+    array_push(state.remesh.queue, jobs[i].section);
+}
+
+// @lod
+#define LOD_SKIRT_DEPTH (1 << LOD_MAX_LEVEL) // how much further than the neighbouring terrain the chunk border walls go down, see build_lod_mesh
+
+static int lod_floor_div(int a, int b) {
+  return a >= 0 ? a/b : -((-a + b - 1)/b);
+}
+
+static LodChunk& get_lod_chunk(int x, int y) {
+  return state.lod.chunks[x & (LOD_GRID_SIZE-1)][y & (LOD_GRID_SIZE-1)];
+}
+
+// the chunks that are drawn with full resolution blocks instead of lod meshes are the ones that are all within r
+// blocks of (x,y). It follows the load area (see @loadarea), so the corners of the block range are lod chunks too
+struct LodHole {
+  int x, y, r;
+};
+
+static LodHole lod_hole() {
+  const Block p = pos_to_block(state.player.pos);
+  return {p.x, p.y, state.world.view_distance - LOD_HOLE_MARGIN};
+}
+
+// same test as the u_clip test in the world object vertex shader
+static bool lod_hole_contains(const LodHole &hole, int x, int y) {
+  // the corner of the chunk farthest from the middle of the hole
+  const int dx = max(hole.x - x*LOD_CHUNK_SIZE, (x+1)*LOD_CHUNK_SIZE - hole.x);
+  const int dy = max(hole.y - y*LOD_CHUNK_SIZE, (y+1)*LOD_CHUNK_SIZE - hole.y);
+  return dx*dx + dy*dy <= hole.r*hole.r;
+}
+
+static float lod_chunk_distance(int x, int y) {
+  const float dx = (x + 0.5f)*LOD_CHUNK_SIZE - state.player.pos.x;
+  const float dy = (y + 0.5f)*LOD_CHUNK_SIZE - state.player.pos.y;
+  return sqrtf(dx*dx + dy*dy);
+}
+
+// the level chunk (x,y) should be meshed at, or 0 if it is too far away to be drawn
+static int lod_chunk_level(int x, int y) {
+  const float d = lod_chunk_distance(x, y);
+  for (int l = 1; l <= LOD_MAX_LEVEL; ++l)
+    if (d < state.lod.level_distances[l-1])
+      return l;
+  return 0;
+}
+
+// How far out each lod level goes, in view distances, so the lod chunks take over where the blocks end at any view distance.
+// At the default view distance that is 256, 448 and 768 blocks. They stop where the lod grid ends
+static const float lod_level_distance_factors[LOD_MAX_LEVEL] = {2.0f, 3.5f, 6.0f};
+#define LOD_MAX_DISTANCE ((LOD_GRID_SIZE/2 - 1)*LOD_CHUNK_SIZE)
+
+static void set_lod_level_distances(int view_distance) {
+  for (int l = 0; l < LOD_MAX_LEVEL; ++l)
+    state.lod.level_distances[l] = min(lod_level_distance_factors[l]*view_distance, (float)LOD_MAX_DISTANCE);
+  // the far terrain starts where the lod chunks end
+  state.lod.needs_update = true;
+  state.far_terrain.needs_update = true;
+}
+
+// how far away we draw blocks or lod chunks
+static float lod_view_distance() {
+  if (!state.lod.enabled)
+    return state.world.view_distance;
+  return state.lod.level_distances[LOD_MAX_LEVEL-1];
+}
+
+// how far away we draw terrain
+static float view_distance() {
+  if (state.far_terrain.enabled)
+    return FAR_TERRAIN_DISTANCE;
+  return lod_view_distance();
+}
+
+// the far plane of everything but the far terrain, see @depthranges
+static float far_plane_distance() {
+  const float d = (float)state.world.view_distance;
+  return max(len(v3{2.0f*d, 2.0f*d, (float)NUM_VISIBLE_BLOCKS_z}), 1.25f*lod_view_distance());
+}
+
+// @depthranges
+// The depth buffer has about d*d/nearz/2^24 blocks of precision at distance d, so with the near plane the blocks need,
+// the far terrain would only get a few blocks of it and z-fight. So everything closer than lod_view_distance is drawn
+// to the front half of the depth range, with a projection that ends right after it (see far_plane_distance), and the
+// far terrain to the back half, with a projection of its own that starts much further out (see far_terrain_projection).
+// The far terrain under the lod chunks is clipped, so the rest of it is behind everything in the front half, except for
+// the clouds, which are in both and are drawn in two parts (see render_transparent_blocks)
+enum DepthRange {
+  DEPTH_RANGE_ALL,
+  DEPTH_RANGE_NEAR,
+  DEPTH_RANGE_FAR,
+};
+
+static void set_depth_range(DepthRange r) {
+  if (!state.far_terrain.enabled || r == DEPTH_RANGE_ALL)
+    glDepthRange(0.0, 1.0);
+  else if (r == DEPTH_RANGE_NEAR)
+    glDepthRange(0.0, 0.5);
+  else
+    glDepthRange(0.5, 1.0);
+}
+
+// proj with the near and far planes of the far depth range. Only the depth changes, so it works for the vr eyes too.
+// The near plane is well before lod_view_distance, since at the edges of the screen the clouds past it are
+// closer to the camera plane than their distance
+static m4 far_terrain_projection(m4 proj) {
+  const float n = 0.25f*lod_view_distance();
+  const float f = 1.25f*FAR_TERRAIN_DISTANCE;
+  proj.d[10] = -(f+n)/(f-n);
+  proj.d[11] = -2.0f*f*n/(f-n);
+  return proj;
+}
+
+static void set_fog() {
+  // fade into the fog right before the view distance, so we don't see where the world ends
+  state.world_object_shader.set("u_fog_near", 0.75f*view_distance());
+  state.world_object_shader.set("u_fog_far", view_distance());
+}
+
+// the height a lod chunk has to cover at some column. Also where the chunk border walls of neighbouring chunks go down to
+static int lod_surface(const WorldXYData &xy) {
+  return max(max(xy.groundlevel, WORLD_WATER_LEVEL), 1);
+}
+
+// lowest surface of n columns, starting at xy[x][y] and stepping (dx,dy)
+static int lod_min_surface(const WorldXYData xy[LOD_CHUNK_SIZE+2][LOD_CHUNK_SIZE+2], int x, int y, int dx, int dy, int n) {
+  int h = lod_surface(xy[x][y]);
+  for (int i = 1; i < n; ++i)
+    h = min(h, lod_surface(xy[x + i*dx][y + i*dy]));
+  return h;
+}
+
+// push the face of a block at p, stretched to the given size
+static void push_scaled_face(Array<WorldObjectVertex> &vertices, BlockType t, Direction dir, v3 p, v3 size) {
+  WorldObjectVertex *v = array_pushn(vertices, 4);
+  block_face_vertices({0, 0, 0}, t, dir, 0, v);
+  for (int i = 0; i < 4; ++i)
+    v[i].pos = p + v3{v[i].pos.x*size.x, v[i].pos.y*size.y, v[i].pos.z*size.z};
+}
+
+// Mesh lod chunk (x,y) at the given level. Only uses world generation and no caches, so it is safe to call from any thread.
+// A cell is solid if at least half of its blocks are, and gets the type of its topmost block.
+// To not get cracks between chunks of different levels (or the full resolution blocks), the sides of cells on the chunk border
+// are drawn all the way down to below the real terrain of the neighbouring columns, so neighbouring chunks overlap instead of leaving gaps
+static void build_lod_mesh(int chunk_x, int chunk_y, int level, Array<WorldObjectVertex> &vertices) {
+  const int S = LOD_CHUNK_SIZE;
+  const int size = 1 << level;
+  const int n = S >> level;
+  const Block origin = {chunk_x*S, chunk_y*S, 0};
+  assert(level >= 1 && level <= LOD_MAX_LEVEL);
+
+  // generation data for the chunk, with a ring of columns around it for the border walls
+  WorldXYData xy[LOD_CHUNK_SIZE+2][LOD_CHUNK_SIZE+2];
+  int top = 0;
+  for (int x = 0; x < S+2; ++x)
+  for (int y = 0; y < S+2; ++y) {
+    xy[x][y] = generate_xy_data(origin.x + x - 1, origin.y + y - 1);
+    top = max(top, lod_surface(xy[x][y]));
+  }
+  const int nz = min(top + size - 1, LOD_MAX_HEIGHT) >> level;
+
+  // downsample
+  u8 cells[LOD_CHUNK_SIZE/2][LOD_CHUNK_SIZE/2][LOD_MAX_HEIGHT/2];
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j)
+  for (int k = 0; k < nz; ++k) {
+    int num_solid = 0, top_z = -1;
+    BlockType top_type = BLOCKTYPE_AIR;
+    for (int x = i*size; x < (i+1)*size; ++x)
+    for (int y = j*size; y < (j+1)*size; ++y)
+    for (int z = k*size; z < (k+1)*size; ++z) {
+      const Block b = {origin.x + x, origin.y + y, z};
+      const BlockType t = b.z <= 0 ? BLOCKTYPE_BEDROCK : generate_blocktype(b, xy[x+1][y+1]);
+      if (t == BLOCKTYPE_AIR)
+        continue;
+      ++num_solid;
+      if (z > top_z)
+        top_z = z, top_type = t;
+    }
+    cells[i][j][k] = (u8)(num_solid*2 >= size*size*size ? top_type : BLOCKTYPE_AIR);
+  }
+
+  // make faces
+  for (int i = 0; i < n; ++i)
+  for (int j = 0; j < n; ++j)
+  for (int k = 0; k < nz; ++k) {
+    const BlockType t = (BlockType)cells[i][j][k];
+    if (t == BLOCKTYPE_AIR)
+      continue;
+    const int cell_top = (k+1)*size + LOD_SKIRT_DEPTH;
+    for (int d = 0; d < DIRECTION_MAX; ++d) {
+      const Direction dir = (Direction)d;
+      bool covered = false;
+      switch (dir) {
+        case DIRECTION_UP:      covered = k+1 < nz && cells[i][j][k+1] != BLOCKTYPE_AIR; break;
+        case DIRECTION_DOWN:    covered = k == 0 || cells[i][j][k-1] != BLOCKTYPE_AIR; break;
+        case DIRECTION_X:       covered = i+1 < n ? cells[i+1][j][k] != BLOCKTYPE_AIR : cell_top <= lod_min_surface(xy, S+1, j*size+1, 0, 1, size); break;
+        case DIRECTION_MINUS_X: covered = i > 0   ? cells[i-1][j][k] != BLOCKTYPE_AIR : cell_top <= lod_min_surface(xy, 0, j*size+1, 0, 1, size); break;
+        case DIRECTION_Y:       covered = j+1 < n ? cells[i][j+1][k] != BLOCKTYPE_AIR : cell_top <= lod_min_surface(xy, i*size+1, S+1, 1, 0, size); break;
+        case DIRECTION_MINUS_Y: covered = j > 0   ? cells[i][j-1][k] != BLOCKTYPE_AIR : cell_top <= lod_min_surface(xy, i*size+1, 0, 1, 0, size); break;
+        default: break;
+      }
+      if (covered)
+        continue;
+
+      const v3 p = {(float)(origin.x + i*size), (float)(origin.y + j*size), (float)(k*size)};
+      push_scaled_face(vertices, t, dir, p, {(float)size, (float)size, (float)size});
+    }
+  }
+}
+
+static int lod_request_cmp(const void *a, const void *b) {
+  const float da = ((const LodRequest*)a)->distance;
+  const float db = ((const LodRequest*)b)->distance;
+  return da < db ? -1 : da > db;
+}
+
+// replace the requests of a queue with new ones (and free them). The ones that are still needed should be in the new list
+static void lod_queue_replace(LodQueue &q, Array<LodRequest> &requests) {
+  qsort(requests.items, requests.size, sizeof(*requests.items), lod_request_cmp);
+  spin_lock(&state.lod.lock);
+  swap(q.requests, requests);
+  q.requests_head = 0;
+  spin_unlock(&state.lod.lock);
+  array_free(requests);
+  for (int i = 0; i < TERRAIN_NUM_THREADS; ++i)
+    semaphore_post(state.lod.wakeup);
+}
+
+// take the nearest request, if it is closer than max_distance
+static bool lod_queue_pop(LodQueue &q, float max_distance, LodRequest *r) {
+  spin_lock(&state.lod.lock);
+  const bool found = q.requests_head < q.requests.size && q.requests[q.requests_head].distance <= max_distance;
+  if (found)
+    *r = q.requests[q.requests_head++];
+  spin_unlock(&state.lod.lock);
+  return found;
+}
+
+static void lod_queue_push_result(LodQueue &q, LodResult r) {
+  spin_lock(&state.lod.lock);
+  array_push(q.results, r);
+  spin_unlock(&state.lod.lock);
+}
+
+// send at most LOD_MAX_UPLOADS_PER_FRAME finished meshes to the gpu. Returns true if some chunk got another level than it wants
+static bool lod_queue_upload_results(LodQueue &q, LodChunk *(*get_chunk)(int x, int y)) {
+  Array<LodResult> results = {};
+  spin_lock(&state.lod.lock);
+  const int n = min(q.results.size, LOD_MAX_UPLOADS_PER_FRAME);
+  array_push(results, q.results.items, n);
+  array_remove_slown(q.results, 0, n);
+  spin_unlock(&state.lod.lock);
+
+  bool needs_update = false;
+  For(results) {
+    LodChunk &c = *get_chunk(it->x, it->y);
+    // the slot might have been given to another chunk while this one was meshed
+    if (c.x == it->x && c.y == it->y) {
+      if (!c.has_vb) {
+        c.vb = VertexBuffer::create_quads(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec));
+        c.has_vb = true;
+      }
+      c.vb.set_vbo_data(it->vertices.items, it->vertices.size, GL_STATIC_DRAW);
+      c.level = it->level;
+      // the player went back and forth while this was meshed
+      if (c.level != c.wanted_level)
+        needs_update = true;
+    }
+    array_free(it->vertices);
+  }
+  array_free(results);
+  return needs_update;
+}
+
+// a chunk slot of a toroidal grid is now chunk (x,y). Returns false if it already was
+static bool lod_chunk_assign(LodChunk &c, int x, int y) {
+  if (c.x == x && c.y == y)
+    return false;
+  c.x = x;
+  c.y = y;
+  c.level = 0;
+  c.vb.num_vertices = 0;
+  return true;
+}
+
+static LodChunk* get_lod_chunk_ptr(int x, int y) {
+  return &get_lod_chunk(x, y);
+}
+
+// pick the level of every lod chunk around the player, and give the terrain threads the ones that need to be (re)meshed
+static void update_lod_levels() {
+  const int cx = lod_floor_div((int)floorf(state.player.pos.x), LOD_CHUNK_SIZE);
+  const int cy = lod_floor_div((int)floorf(state.player.pos.y), LOD_CHUNK_SIZE);
+  state.lod.center_x = cx;
+  state.lod.center_y = cy;
+  state.lod.center_pos = state.player.pos;
+  state.lod.needs_update = false;
+
+  // this covers every slot in the grid exactly once
+  Array<LodRequest> requests = {};
+  for (int x = cx - LOD_GRID_SIZE/2; x < cx + LOD_GRID_SIZE/2; ++x)
+  for (int y = cy - LOD_GRID_SIZE/2; y < cy + LOD_GRID_SIZE/2; ++y) {
+    LodChunk &c = get_lod_chunk(x, y);
+    lod_chunk_assign(c, x, y);
+    c.wanted_level = lod_chunk_level(x, y);
+    if (c.wanted_level && c.level != c.wanted_level)
+      array_push(requests, LodRequest{x, y, c.wanted_level, lod_chunk_distance(x, y)});
+  }
+  lod_queue_replace(state.lod.queue, requests);
+}
+
+// mesh the nearest requested lod chunk, if it is closer than max_distance. Returns false if there was nothing to do
+static bool lod_process_request(float max_distance = INFINITY) {
+  LodRequest r;
+  if (!lod_queue_pop(state.lod.queue, max_distance, &r))
+    return false;
+
+  LodResult result = {r.x, r.y, r.level, {}};
+  build_lod_mesh(r.x, r.y, r.level, result.vertices);
+  lod_queue_push_result(state.lod.queue, result);
+  return true;
+}
+
+// @farterrain
+static LodChunk* get_far_terrain_tile(int x, int y) {
+  return &state.far_terrain.tiles[x & (FAR_TERRAIN_GRID_SIZE-1)][y & (FAR_TERRAIN_GRID_SIZE-1)];
+}
+
+// distance from the player to the closest and furthest point of tile (x,y)
+static void far_terrain_tile_distance(int x, int y, float *closest, float *furthest) {
+  const float x0 = (float)(x*FAR_TERRAIN_TILE_SIZE), x1 = x0 + FAR_TERRAIN_TILE_SIZE;
+  const float y0 = (float)(y*FAR_TERRAIN_TILE_SIZE), y1 = y0 + FAR_TERRAIN_TILE_SIZE;
+  const v3 p = state.player.pos;
+  const float cx = clamp(p.x, x0, x1) - p.x, cy = clamp(p.y, y0, y1) - p.y;
+  const float fx = max(fabsf(x0 - p.x), fabsf(x1 - p.x)), fy = max(fabsf(y0 - p.y), fabsf(y1 - p.y));
+  *closest = sqrtf(cx*cx + cy*cy);
+  *furthest = sqrtf(fx*fx + fy*fy);
+}
+
+// the level tile (x,y) should be made at, or 0 if it is out of range, or completely covered by lod chunks
+static int far_terrain_tile_level(int x, int y) {
+  float closest, furthest;
+  far_terrain_tile_distance(x, y, &closest, &furthest);
+  if (closest > FAR_TERRAIN_DISTANCE || furthest < lod_view_distance() - LOD_CHUNK_SIZE)
+    return 0;
+  return closest < FAR_TERRAIN_FAR_LEVEL_DISTANCE ? FAR_TERRAIN_NEAR_LEVEL : FAR_TERRAIN_FAR_LEVEL;
+}
+
+// the height and type of a far terrain column, sampled in the middle of the column
+static int far_terrain_column(int x, int y, int size, BlockType *type) {
+  const Block b = {x*size + size/2, y*size + size/2, 0};
+  const WorldXYData xy = generate_xy_data(b.x, b.y);
+  const int h = lod_surface(xy);
+  if (type)
+    *type = h <= 1 ? BLOCKTYPE_BEDROCK : generate_blocktype({b.x, b.y, h-1}, xy);
+  return h;
+}
+
+// Make the heightmap of tile (x,y). Only uses world generation, so it is safe to call from any thread.
+// Every column is a top face and walls down to a bit below the neighbouring columns (FAR_TERRAIN_SKIRT), so columns of different levels,
+// and the lod chunks, overlap instead of leaving cracks between them
+static void build_far_terrain_mesh(int tile_x, int tile_y, int level, Array<WorldObjectVertex> &vertices) {
+  const int size = 1 << level;
+  const int n = FAR_TERRAIN_TILE_SIZE >> level;
+  const int x0 = tile_x*n, y0 = tile_y*n; // first column
+
+  // heights with a ring of columns around the tile
+  int heights[18][18];
+  BlockType types[18][18];
+  for (int i = 0; i < n+2; ++i)
+  for (int j = 0; j < n+2; ++j)
+    heights[i][j] = far_terrain_column(x0+i-1, y0+j-1, size, &types[i][j]);
+
+  for (int i = 1; i <= n; ++i)
+  for (int j = 1; j <= n; ++j) {
+    const int h = heights[i][j];
+    const v3 p = {(float)((x0+i-1)*size), (float)((y0+j-1)*size), 0.0f};
+    push_scaled_face(vertices, types[i][j], DIRECTION_UP, p, {(float)size, (float)size, (float)h});
+
+    const struct {Direction dir; int neighbour;} sides[] = {
+      {DIRECTION_X,       heights[i+1][j]},
+      {DIRECTION_MINUS_X, heights[i-1][j]},
+      {DIRECTION_Y,       heights[i][j+1]},
+      {DIRECTION_MINUS_Y, heights[i][j-1]},
+    };
+    for (int s = 0; s < (int)ARRAY_LEN(sides); ++s) {
+      const int bottom = max(sides[s].neighbour - FAR_TERRAIN_SKIRT, 0);
+      if (bottom < h)
+        push_scaled_face(vertices, types[i][j], sides[s].dir, {p.x, p.y, (float)bottom}, {(float)size, (float)size, (float)(h - bottom)});
+    }
+  }
+}
+
+// pick the level of every far terrain tile around the player, and give the terrain threads the ones that need to be (re)made
+static void update_far_terrain_levels() {
+  const int cx = lod_floor_div((int)floorf(state.player.pos.x), FAR_TERRAIN_TILE_SIZE);
+  const int cy = lod_floor_div((int)floorf(state.player.pos.y), FAR_TERRAIN_TILE_SIZE);
+  state.far_terrain.center_x = cx;
+  state.far_terrain.center_y = cy;
+  state.far_terrain.needs_update = false;
+
+  Array<LodRequest> requests = {};
+  for (int x = cx - FAR_TERRAIN_GRID_SIZE/2; x < cx + FAR_TERRAIN_GRID_SIZE/2; ++x)
+  for (int y = cy - FAR_TERRAIN_GRID_SIZE/2; y < cy + FAR_TERRAIN_GRID_SIZE/2; ++y) {
+    LodChunk &c = *get_far_terrain_tile(x, y);
+    lod_chunk_assign(c, x, y);
+    c.wanted_level = far_terrain_tile_level(x, y);
+    float closest, furthest;
+    far_terrain_tile_distance(x, y, &closest, &furthest);
+    if (c.wanted_level && c.level != c.wanted_level)
+      array_push(requests, LodRequest{x, y, c.wanted_level, closest});
+  }
+  lod_queue_replace(state.far_terrain.queue, requests);
+}
+
+static bool far_terrain_process_request() {
+  LodRequest r;
+  if (!lod_queue_pop(state.far_terrain.queue, INFINITY, &r))
+    return false;
+
+  LodResult result = {r.x, r.y, r.level, {}};
+  build_far_terrain_mesh(r.x, r.y, r.level, result.vertices);
+  lod_queue_push_result(state.far_terrain.queue, result);
+  return true;
+}
+
+// pick new levels when the player moved to another chunk or tile, and send finished meshes to the gpu
+static void update_lod() {
+  if (!state.lod.enabled)
+    return;
+
+  const int cx = lod_floor_div((int)floorf(state.player.pos.x), LOD_CHUNK_SIZE);
+  const int cy = lod_floor_div((int)floorf(state.player.pos.y), LOD_CHUNK_SIZE);
+  if (cx != state.lod.center_x || cy != state.lod.center_y || state.lod.needs_update)
+    update_lod_levels();
+  if (lod_queue_upload_results(state.lod.queue, get_lod_chunk_ptr))
+    state.lod.needs_update = true;
+
+  if (!state.far_terrain.enabled)
+    return;
+  const int tx = lod_floor_div((int)floorf(state.player.pos.x), FAR_TERRAIN_TILE_SIZE);
+  const int ty = lod_floor_div((int)floorf(state.player.pos.y), FAR_TERRAIN_TILE_SIZE);
+  if (tx != state.far_terrain.center_x || ty != state.far_terrain.center_y || state.far_terrain.needs_update)
+    update_far_terrain_levels();
+  if (lod_queue_upload_results(state.far_terrain.queue, get_far_terrain_tile))
+    state.far_terrain.needs_update = true;
+}
+
+// With wait, the chunks around the loaded blocks are meshed before the first frame, so we don't see gaps at the edge
+// of the hole. The terrain threads take care of the rest
+static void lod_init(bool wait) {
+  update_lod_levels();
+  while (wait && lod_process_request(state.world.view_distance + LOD_CHUNK_SIZE))
+    ;
+  if (state.far_terrain.enabled)
+    update_far_terrain_levels();
+}
+
+// WARNING: doesn't lock, use set_blocktype unless you already hold state.block_loader.lock
+static void set_blocktype_nolock(Block b, BlockType new_type) {
+  assert(new_type != BLOCKTYPE_NULL);
+
+  push_blockdiff(b, new_type);
+
+  // the faces of the block itself, the faces of the adjacent blocks that face it, and the occlusion of all blocks around it
+  request_remesh({b - v3i{1,1,1}, b + v3i{1,1,1}}, true);
+}
+
+static void lock_times_add(LockTimes *t, u64 ticks) {
+  const double ns = (double)ticks * 1e9 / (double)mine_performance_frequency();
+  const int i = ns < 1.0 ? 0 : min((int)(log2(ns)*4.0), LOCK_TIMES_BUCKETS-1);
+  atomic_add(&t->counts[i], 1);
+  if (ns > atomic_get(&t->max_ns))
+    atomic_set(&t->max_ns, (int)min(ns, 2e9));
+}
+
+// the time in microseconds that the fraction p of the times are below. Rounded up to the end of its bucket
+static float lock_times_percentile(LockTimes *t, float p) {
+  int total = 0;
+  for (int i = 0; i < LOCK_TIMES_BUCKETS; ++i)
+    total += atomic_get(&t->counts[i]);
+  int n = 0;
+  for (int i = 0; i < LOCK_TIMES_BUCKETS; ++i) {
+    n += atomic_get(&t->counts[i]);
+    if (n && n >= p*total)
+      return exp2f((i+1)/4.0f) / 1000.0f;
+  }
+  return 0.0f;
+}
+
+static float lock_times_max(LockTimes *t) {
+  return atomic_get(&t->max_ns) / 1000.0f;
+}
+
+// Take state.block_loader.lock, and count how long we waited for it in wait. Returns when we got it, pass it to
+// block_loader_unlock. The main thread takes the lock when the player places or removes a block, so anyone that
+// holds it for long makes the frame hitch
+static u64 block_loader_lock(LockTimes *wait) {
+  const u64 start = mine_performance_counter();
+  spin_lock(&state.block_loader.lock);
+  const u64 locked_at = mine_performance_counter();
+  lock_times_add(wait, locked_at - start);
+  return locked_at;
+}
+
+static void block_loader_unlock(u64 locked_at, LockTimes *hold) {
+  lock_times_add(hold, mine_performance_counter() - locked_at);
+  spin_unlock(&state.block_loader.lock);
+}
+
+static void set_blocktype(Block b, BlockType new_type) {
+  // this code might manipulate blocks in the world, so we need to lock on state.blocks_lock
+  // so we don't collide with the block loader :)
+  const u64 locked_at = block_loader_lock(&state.block_loader.main_lock_wait);
+  set_blocktype_nolock(b, new_type);
+  block_loader_unlock(locked_at, &state.block_loader.main_lock_hold);
+
+  if (new_type == BLOCKTYPE_AIR)
+    printf("Setting block (%i %i %i) to air\n", b.x, b.y, b.z);
+}
+
+// The block loader queue is Dmitry Vyukov's bounded MPMC queue (http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue).
+// The sequence number of a slot says whose turn it is: when it equals the position of the slot, a producer can write
+// to it, and when it is one past the position, a consumer can read it. Positions only grow, so they are compared with
+// unsigned differences to survive wrapping
+
+static int block_loader_commands_queued() {
+  return (int)((unsigned)atomic_get(&state.block_loader.commands_head) - (unsigned)atomic_get(&state.block_loader.commands_tail));
+}
+
+// returns false if the queue is full. Safe to call from any thread
+static bool try_push_block_loader_command(BlockLoaderCommand command) {
+  for (;;) {
+    const int head = atomic_get(&state.block_loader.commands_head);
+    auto &slot = state.block_loader.commands[head & (MAX_BLOCK_LOADER_COMMANDS-1)];
+    const int diff = (int)((unsigned)atomic_get(&slot.sequence) - (unsigned)head);
+    memory_barrier_acquire();
+
+    if (diff < 0) {
+      // a consumer hasn't taken the command from the last lap yet
+      atomic_inc(&state.block_loader.num_full);
+      return false;
+    }
+    // if diff > 0 another producer took the slot, so try again
+    if (diff > 0 || !atomic_cas(&state.block_loader.commands_head, head, head + 1))
+      continue;
+
+    slot.command = command;
+    memory_barrier_release();
+    atomic_set(&slot.sequence, head + 1);
+
+    // record the deepest the queue has been
+    const int queued = block_loader_commands_queued();
+    for (int max = atomic_get(&state.block_loader.max_commands_queued); queued > max; max = atomic_get(&state.block_loader.max_commands_queued))
+      if (atomic_cas(&state.block_loader.max_commands_queued, max, queued))
+        break;
+    return true;
+  }
+}
+
+// returns false if the queue is empty. Safe to call from any thread
+static bool try_pop_block_loader_command(BlockLoaderCommand *command_out) {
+  for (;;) {
+    const int tail = atomic_get(&state.block_loader.commands_tail);
+    auto &slot = state.block_loader.commands[tail & (MAX_BLOCK_LOADER_COMMANDS-1)];
+    const int diff = (int)((unsigned)atomic_get(&slot.sequence) - (unsigned)(tail + 1));
+    memory_barrier_acquire();
+
+    if (diff < 0)
+      return false;
+    // if diff > 0 another consumer took the slot, so try again
+    if (diff > 0 || !atomic_cas(&state.block_loader.commands_tail, tail, tail + 1))
+      continue;
+
+    *command_out = slot.command;
+    memory_barrier_release();
+    atomic_set(&slot.sequence, tail + MAX_BLOCK_LOADER_COMMANDS);
+    return true;
+  }
+}
+
+// queue a command for the block loader. It is split into one job per section it touches, and the jobs go to the
+// block loader in order of priority, see update_block_loader_jobs. Main thread only
+static void push_block_loader_command(BlockLoaderCommand command) {
+  const BlockRange r = command.range;
+  for (int sx = r.a.x >> SECTION_SIZE_BITS; sx <= r.b.x >> SECTION_SIZE_BITS; ++sx)
+  for (int sy = r.a.y >> SECTION_SIZE_BITS; sy <= r.b.y >> SECTION_SIZE_BITS; ++sy)
+  for (int sz = r.a.z >> SECTION_SIZE_BITS; sz <= r.b.z >> SECTION_SIZE_BITS; ++sz) {
+    const Block a = {sx*SECTION_SIZE, sy*SECTION_SIZE, sz*SECTION_SIZE};
+    BlockLoaderCommand job = command;
+    range_intersect(r, {a, a + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1}}, &job.range);
+    array_push(state.block_loader.jobs, job);
+  }
+}
+
+struct BlockLoaderJobOrder {
+  int job;
+  float priority; // lower goes first
+};
+
+static int block_loader_job_blocks(const BlockLoaderCommand &job) {
+  const BlockRange &r = job.range;
+  return (r.b.x - r.a.x + 1)*(r.b.y - r.a.y + 1)*(r.b.z - r.a.z + 1);
+}
+
+// the block loader started a command, see @prefetch
+static void block_loader_busy_begin() {
+  spin_lock(&state.block_loader.busy_lock);
+  if (!state.block_loader.num_running++)
+    state.block_loader.busy_since = mine_performance_counter();
+  spin_unlock(&state.block_loader.busy_lock);
+}
+
+static void block_loader_busy_end(int blocks) {
+  const u64 now = mine_performance_counter();
+  spin_lock(&state.block_loader.busy_lock);
+  state.block_loader.blocks_done += (u32)blocks;
+  if (!--state.block_loader.num_running)
+    state.block_loader.busy_us += (u32)((now - state.block_loader.busy_since)*1000000/mine_performance_frequency());
+  spin_unlock(&state.block_loader.busy_lock);
+}
+
+// Pop a command from the block loader queue and do it. Returns false if the queue was empty. This is the background
+// work of the task workers (see @tasks), so many threads can do commands at the same time, but never two for the same
+// part of the block cache (see update_block_loader_jobs)
+static bool run_one_block_loader_command() {
+  BlockLoaderCommand command;
+  if (!try_pop_block_loader_command(&command))
+    return false;
+  block_loader_busy_begin();
+
+  // Blocks are generated here before we take the lock, so that we only hold it while we copy them into the cache.
+  // A command never covers more than one section (see push_block_loader_command), so its rows along z are next to
+  // each other in the cache, and each row is a single copy
+  u8 types[SECTION_SIZE][SECTION_SIZE][SECTION_SIZE];
+  const BlockRange &r = command.range;
+  const BlockIndex a = block_to_blockindex(r.a);
+  const int nx = r.b.x - r.a.x + 1, ny = r.b.y - r.a.y + 1, nz = r.b.z - r.a.z + 1;
+  assert(nx <= SECTION_SIZE && ny <= SECTION_SIZE && nz <= SECTION_SIZE);
+  assert(command.type == BlockLoaderCommand::LOAD_BLOCK || command.type == BlockLoaderCommand::UNLOAD_BLOCK);
+  const bool load = command.type == BlockLoaderCommand::LOAD_BLOCK;
+
+  if (load)
+    for (int x = 0; x < nx; ++x)
+    for (int y = 0; y < ny; ++y) {
+      const WorldXYData xy_data = get_world_xy_data(r.a + v3i{x,y,0});
+      for (int z = 0; z < nz; ++z)
+        types[x][y][z] = (u8)calc_blocktype(r.a + v3i{x,y,z}, xy_data);
+    }
+
+  // if we only unload blocks that were never loaded, nothing changes and there is nothing to remesh
+  bool changed = load;
+  Section *s = get_section(a);
+  const u64 locked_at = block_loader_lock(&state.block_loader.loader_lock_wait);
+  section_write_begin(s);
+  for (int x = 0; x < nx; ++x)
+  for (int y = 0; y < ny; ++y) {
+    u8 *row = get_block_cache({a.x + x, a.y + y, a.z});
+    if (load) {
+      memcpy(row, types[x][y], nz);
+    } else {
+      for (int z = 0; z < nz; ++z)
+        changed |= row[z] != BLOCKTYPE_NULL;
+      memset(row, BLOCKTYPE_NULL, nz);
+    }
+  }
+  section_write_end(s);
+  block_loader_unlock(locked_at, &state.block_loader.loader_lock_hold);
+  if (changed)
+    block_loader_request_remesh(command.range);
+  block_loader_busy_end(nx*ny*nz);
+  atomic_set(&s->loader_command_queued, 0);
+  atomic_add(&state.block_loader.blocks_queued, -block_loader_job_blocks(command));
+  atomic_add(&state.block_loader.commands_running, -1);
+  return true;
+}
+
+// Give the block loader the most urgent jobs, until it has BLOCK_LOADER_MAX_QUEUED_BLOCKS blocks of work.
+// The priorities are calculated every frame, so when the player turns around, what is in front of them goes first.
+// Main thread only
+static void update_block_loader_jobs() {
+  Array<BlockLoaderCommand> &jobs = state.block_loader.jobs;
+
+  // Drop the work that is no longer wanted: loads of sections that were unloaded again before they were loaded,
+  // and unloads of sections that were loaded again before they were unloaded.
+  // This is always safe, since the last job for a section is never dropped: after a load the section stays resident
+  // (see @residency) until the next unload is pushed, and the other way around. Whatever the last job leaves in the cache is what should be there
+  int n = 0;
+  for (int i = 0; i < jobs.size; ++i) {
+    const BlockLoaderCommand &job = jobs[i];
+    if (section_is_resident(job.range.a) == (job.type == BlockLoaderCommand::LOAD_BLOCK))
+      jobs[n++] = job;
+    else
+      ++state.block_loader.num_cancelled;
+  }
+  jobs.size = n;
+  if (!jobs.size)
+    return;
+
+  // Only the first job of each section can go, the later ones wait for it, and it waits for the command the block
+  // loader has for the same part of the block cache, if it has one. The block loader does many commands at the same
+  // time, so this is what keeps the loads and unloads of a part of the block cache in the order they were pushed.
+  // The jobs right after it that do the same thing are merged into it when we can, so that when the player moves one
+  // block at a time, the section is done in one go instead of one slice at a time
+  static u32 pass;
+  ++pass;
+  const SectionView view = section_view();
+  static Array<BlockLoaderJobOrder> order;
+  static Array<u8> done;
+  order.size = 0;
+  array_resize(done, jobs.size);
+  memset(done.items, 0, done.size);
+  for (int i = 0; i < jobs.size; ++i) {
+    Section *s = get_section(block_to_blockindex(jobs[i].range.a));
+    if (s->loader_jobs_pass != pass) {
+      s->loader_jobs_pass = pass;
+      s->loader_first_job = -1;
+      if (atomic_get(&s->loader_command_queued))
+        continue;
+      s->loader_first_job = i;
+      // unloading is cheap, and the loads of the section might be waiting for it
+      const float priority = jobs[i].type == BlockLoaderCommand::UNLOAD_BLOCK ? -1.0f : section_priority(jobs[i].range.a, view);
+      array_push(order, {i, priority});
+      continue;
+    }
+    if (s->loader_first_job < 0)
+      continue;
+    BlockLoaderCommand &first = jobs[s->loader_first_job];
+    if (jobs[i].type != first.type)
+      s->loader_first_job = -1;
+    else if (range_merge(&first.range, jobs[i].range))
+      done[i] = 1, ++state.block_loader.num_coalesced;
+  }
+
+  int budget = BLOCK_LOADER_MAX_QUEUED_BLOCKS - atomic_get(&state.block_loader.blocks_queued);
+  if (budget > 0) {
+    job_heap_make(order);
+    while (order.size && budget > 0) {
+      const int j = job_heap_pop(order).job;
+      const BlockLoaderCommand &job = jobs[j];
+      const int num_blocks = block_loader_job_blocks(job);
+      Section *s = get_section(block_to_blockindex(job.range.a));
+      atomic_add(&state.block_loader.blocks_queued, num_blocks);
+      atomic_set(&s->loader_command_queued, 1);
+      atomic_inc(&state.block_loader.commands_running);
+      if (!try_push_block_loader_command(job)) {
+        atomic_add(&state.block_loader.commands_running, -1);
+        atomic_set(&s->loader_command_queued, 0);
+        atomic_add(&state.block_loader.blocks_queued, -num_blocks);
+        break;
+      }
+      wake_task_worker();
+      budget -= num_blocks;
+      done[j] = 1;
+    }
+  }
+
+  // remove the jobs we gave away or merged, and keep the rest in order
+  n = 0;
+  for (int i = 0; i < jobs.size; ++i)
+    if (!done[i])
+      jobs[n++] = jobs[i];
+  jobs.size = n;
+}
+
+/* in: line, plane, plane origin */
+static bool collision_plane(v3 x0, v3 x1, v3 p0, v3 p1, v3 p2, float *t_out, v3 *n_out) {
+  float d, t,u,v;
+  v3 n, dx;
+
+  dx = x1-x0;
+
+  p1 = p1 - p0;
+  p2 = p2 - p0;
+
+  n = cross(p1, p2);
+
+  d = dx*n;
 
   if (fabs(d) < 0.0001f)
     return false;
@@ -3015,86 +5948,127 @@ static void push_text(const char *str, v2 pos, float height, TextAlignment align
   }
 }
 
-static void tool_graphics_init() {
-  state.tool_vb = VertexBuffer::create(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec), true);
-  gl_ok_or_die;
-  Array<WorldObjectVertex> tool_vertices = {};
-  Array<uint> tool_elements = {};
+// where on the block texture the faces of voxel models get their color from, per direction
+static const r2 voxel_model_texpos[DIRECTION_MAX] = {
+  {0.1f, 0.1f, 0.2f, 0.2f}, // up
+  {0.5f, 0.5f, 0.6f, 0.6f}, // x
+  {0.2f, 0.2f, 0.3f, 0.3f}, // y
+  {0.7f, 0.7f, 0.8f, 0.8f}, // -y
+  {0.5f, 0.5f, 0.6f, 0.6f}, // -x
+  {0.8f, 0.8f, 0.9f, 0.9f}, // down
+};
+
+static bool voxel_is_solid(const u8 *voxels, const int size[3], const int p[3]) {
+  for (int i = 0; i < 3; ++i)
+    if (p[i] < 0 || p[i] >= size[i])
+      return false;
+  return voxels[(p[2]*size[1] + p[1])*size[0] + p[0]];
+}
+
+// mesh a grid of size[0]*size[1]*size[2] voxels, where voxels[(z*size[1] + y)*size[0] + x] is nonzero if the voxel is solid.
+// The voxel (x,y,z) goes from origin + (x,y,z)*scale to origin + (x+1,y+1,z+1)*scale
+static void mesh_voxels(const u8 *voxels, const int size[3], v3 origin, float scale, Array<WorldObjectVertex> &vertices) {
+  Array<u8> faces = {};
+
+  for (int d = 0; d < DIRECTION_MAX; ++d) {
+    const Direction dir = (Direction)d;
+    const v3 n = direction_to_normal(dir);
+    const int normal[3] = {(int)n.x, (int)n.y, (int)n.z};
+    // a is the axis the faces point along, and u and v are the axes of the faces
+    const int a = normal[0] ? 0 : normal[1] ? 1 : 2;
+    const int u = (a+1)%3, v = (a+2)%3;
+    array_resize(faces, size[u]*size[v]);
+
+    for (int s = 0; s < size[a]; ++s) {
+      // find the faces in this slice that aren't hidden by a neighbour
+      for (int j = 0; j < size[v]; ++j)
+      for (int i = 0; i < size[u]; ++i) {
+        int p[3], q[3];
+        p[a] = s, p[u] = i, p[v] = j;
+        q[0] = p[0] + normal[0], q[1] = p[1] + normal[1], q[2] = p[2] + normal[2];
+        faces[j*size[u] + i] = voxel_is_solid(voxels, size, p) && !voxel_is_solid(voxels, size, q);
+      }
+
+      // merge them into rectangles, each first as wide and then as tall as it can be
+      for (int j = 0; j < size[v]; ++j)
+      for (int i = 0; i < size[u];) {
+        if (!faces[j*size[u] + i]) {
+          ++i;
+          continue;
+        }
+        int w = 1, h = 1;
+        while (i + w < size[u] && faces[j*size[u] + i + w])
+          ++w;
+        for (; j + h < size[v]; ++h) {
+          int k = 0;
+          while (k < w && faces[(j+h)*size[u] + i + k])
+            ++k;
+          if (k < w)
+            break;
+        }
+        for (int y = j; y < j + h; ++y)
+          memset(&faces[y*size[u] + i], 0, w);
+
+        float p[3], p2[3];
+        p[a] = (float)s, p2[a] = (float)(s+1);
+        p[u] = (float)i, p2[u] = (float)(i+w);
+        p[v] = (float)j, p2[v] = (float)(j+h);
+        box_face_vertices(origin + v3{p[0], p[1], p[2]}*scale, origin + v3{p2[0], p2[1], p2[2]}*scale, dir, voxel_model_texpos[d], array_pushn(vertices, 4));
+        i += w;
+      }
+    }
+  }
+
+  array_free(faces);
+}
+
+// get the model of a sprite file, and build it the first time.
+// Every pixel that isn't magenta becomes a voxel, and the model is centered on x and y, with z from 0 to scale
+static VoxelModel* voxel_model_get(const char *filename, float scale) {
+  for (int i = 0; i < state.num_voxel_models; ++i)
+    if (!strcmp(state.voxel_models[i].filename, filename))
+      return &state.voxel_models[i];
+
+  if (state.num_voxel_models == MAX_VOXEL_MODELS)
+    die("Too many voxel models, max is %i", MAX_VOXEL_MODELS);
+  if (strlen(filename) >= sizeof(state.voxel_models[0].filename))
+    die("Voxel model filename %s is too long", filename);
 
-  // open the tools file, and find all pixel positions,
-  // and draw each pixel as a small block
   int w,h;
   stbi_set_flip_vertically_on_load(1);
-  unsigned char *data = stbi_load("tools.bmp", &w, &h, 0, 3);
+  unsigned char *data = stbi_load(filename, &w, &h, 0, 3);
   if (!data)
-    die("Failed to load tools.bmp");
+    die("Failed to load %s", filename);
 
-  const float scale = 0.1f;
-  const float size = 1.0;
+  u8 *voxels = (u8*)malloc(w*h);
+  for (int i = 0; i < w*h; ++i)
+    voxels[i] = !(data[i*3] == 255 && data[i*3 + 1] == 0 && data[i*3 + 2] == 255);
+  stbi_image_free(data);
 
-  for (int yi = 0; yi < h; ++yi)
-  for (int xi = 0; xi < w; ++xi) {
-    int r = data[(yi*w + xi)*3];
-    int g = data[(yi*w + xi)*3 + 1];
-    int b = data[(yi*w + xi)*3 + 2];
-    if (r == 255 && g == 0 && b == 255)
-      continue;
+  const int size[3] = {w, h, 1};
+  Array<WorldObjectVertex> vertices = {};
+  mesh_voxels(voxels, size, v3{-(w/2)*scale, -(h/2)*scale, 0.0f}, scale, vertices);
+  free(voxels);
+
+  VoxelModel *model = &state.voxel_models[state.num_voxel_models++];
+  *model = {};
+  strcpy(model->filename, filename);
+  model->vb = VertexBuffer::create_quads(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec));
+  model->vb.enable_instances();
+  model->vb.set_vbo_data(vertices.items, vertices.size, GL_STATIC_DRAW);
+  gl_ok_or_die;
+  array_free(vertices);
+  return model;
+}
 
-    float x = (xi - w/2)*scale;
-    float y = (yi - h/2)*scale;
-    float x2 = x + size*scale;
-    float y2 = y + size*scale;
-    float z = 0;
-    float z2 = size*scale;
-
-    WorldObjectVertex *v = array_pushn(tool_vertices, 4*6);
-    *v++ = {x,  y,  z2, {0.1f, 0.1f}, {0.0f, 0.0f, 1.0f}};
-    *v++ = {x2, y,  z2, {0.2f, 0.1f}, {0.0f, 0.0f, 1.0f}};
-    *v++ = {x2, y2, z2, {0.2f, 0.2f}, {0.0f, 0.0f, 1.0f}};
-    *v++ = {x,  y2, z2, {0.1f, 0.2f}, {0.0f, 0.0f, 1.0f}};
-    *v++ = {x2, y,  z,  {0.8f, 0.8f}, {0.0f, 0.0f, -1.0f}};
-    *v++ = {x,  y,  z,  {0.9f, 0.8f}, {0.0f, 0.0f, -1.0f}};
-    *v++ = {x,  y2, z,  {0.9f, 0.9f}, {0.0f, 0.0f, -1.0f}};
-    *v++ = {x2, y2, z,  {0.8f, 0.9f}, {0.0f, 0.0f, -1.0f}};
-    *v++ = {x2, y,  z,  {0.5f, 0.5f}, {1.0f, 0.0f, 0.0f}};
-    *v++ = {x2, y2, z,  {0.6f, 0.5f}, {1.0f, 0.0f, 0.0f}};
-    *v++ = {x2, y2, z2, {0.6f, 0.6f}, {1.0f, 0.0f, 0.0f}};
-    *v++ = {x2, y,  z2, {0.5f, 0.6f}, {1.0f, 0.0f, 0.0f}};
-    *v++ = {x2, y2, z,  {0.2f, 0.2f}, {0.0f, 1.0f, 0.0f}};
-    *v++ = {x,  y2, z,  {0.3f, 0.2f}, {0.0f, 1.0f, 0.0f}};
-    *v++ = {x,  y2, z2, {0.3f, 0.3f}, {0.0f, 1.0f, 0.0f}};
-    *v++ = {x2, y2, z2, {0.2f, 0.3f}, {0.0f, 1.0f, 0.0f}};
-    *v++ = {x, y2, z,   {0.5f, 0.5f}, {-1.0f, 0.0f, 0.0f}};
-    *v++ = {x, y,  z,   {0.6f, 0.5f}, {-1.0f, 0.0f, 0.0f}};
-    *v++ = {x, y,  z2,  {0.6f, 0.6f}, {-1.0f, 0.0f, 0.0f}};
-    *v++ = {x, y2, z2,  {0.5f, 0.6f}, {-1.0f, 0.0f, 0.0f}};
-    *v++ = {x,  y, z,   {0.7f, 0.7f}, {0.0f, -1.0f, 0.0f}};
-    *v++ = {x2, y, z,   {0.8f, 0.7f}, {0.0f, -1.0f, 0.0f}};
-    *v++ = {x2, y, z2,  {0.8f, 0.8f}, {0.0f, -1.0f, 0.0f}};
-    *v++ = {x,  y, z2,  {0.7f, 0.8f}, {0.0f, -1.0f, 0.0f}};
-  }
-
-  for (int i = 0; i < tool_vertices.size; i += 4) {
-    uint *e = array_pushn(tool_elements, 6);
-    *e++ = i;
-    *e++ = i+1;
-    *e++ = i+2;
-    *e++ = i;
-    *e++ = i+2;
-    *e++ = i+3;
-  }
-  state.tool_vb.set_data(tool_vertices.items, tool_vertices.size, tool_elements.items, tool_elements.size, GL_STATIC_DRAW);
-  assert(state.tool_vb.num_items() == tool_elements.size);
-  assert(state.tool_vb.num_vertices == tool_vertices.size);
-  assert(state.tool_vb.num_elements == tool_elements.size);
-
-  array_free(tool_vertices);
-  array_free(tool_elements);
-  stbi_image_free(data);
+// draw the model with the given model matrix this frame
+static void push_voxel_model(VoxelModel *model, const m4 &transform) {
+  array_push(model->instances, transform);
+}
 
-  // set up pipeline
-  state.tool_pipeline = state.opaque_block_pipeline;
-  state.tool_pipeline.vb = &state.tool_vb;
+static void voxel_model_graphics_init() {
+  state.voxel_model_pipeline = state.opaque_block_pipeline;
+  state.tool_model = voxel_model_get("tools.bmp", 0.1f);
 }
 
 static void block_graphics_init() {
@@ -3102,28 +6076,31 @@ static void block_graphics_init() {
 
   state.world_object_shader = Shader::create_from_string(world_object_vertex_shader, world_object_fragment_shader);
   state.opaque_block_pipeline.shader = &state.world_object_shader;
-  state.opaque_block_pipeline.shader->set("u_fog_near", 100.0f);
-  state.opaque_block_pipeline.shader->set("u_fog_far", 130.0f);
+  set_fog();
   state.opaque_block_pipeline.shader->set("u_texture", 0);
   state.opaque_block_pipeline.textures[state.opaque_block_pipeline.num_textures++] = &state.block_texture;
   state.opaque_block_pipeline.shader->set("u_shadowmap", 1);
   state.opaque_block_pipeline.textures[state.opaque_block_pipeline.num_textures++] = &state.shadowmap;
   state.opaque_block_pipeline.shader->set("u_skybox", 2);
   state.opaque_block_pipeline.textures[state.opaque_block_pipeline.num_textures++] = &state.skybox.texture;
-  state.opaque_block_vb = VertexBuffer::create(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec), true);
-  state.opaque_block_pipeline.vb = &state.opaque_block_vb;
+  for (int t = 0; t < 2; ++t)
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i)
+    state.block_vbs[t][d][i] = VertexBuffer::create_quads(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec));
+  // the vertex buffers of the pipelines are set per bucket, see render_block_buckets
+  state.opaque_block_pipeline.vb = &state.block_vbs[0][0][0];
   state.opaque_block_pipeline.framebuffer = &state.gbuffer;
-  state.opaque_block_pipeline.render_flags = RENDERFLAG_CULL_BACK_FACE | RENDERFLAG_DEPTH_TEST;
+  state.opaque_block_pipeline.render_flags = RENDERFLAG_CULL_BACK_FACE | RENDERFLAG_DEPTH_TEST | RENDERFLAG_CLIP;
 
   blocktype_to_texpos(BLOCKTYPE_WATER, &state.water_texture_pos.x, &state.water_texture_pos.y, &state.water_texture_pos.w, &state.water_texture_pos.h);
   if (state.water_texture_pos.w*state.water_texture_pos.h*4 != ARRAY_LEN(state.water_texture_buffer))
     die("Maths went wrong, expected %lu but got %i", ARRAY_LEN(state.water_texture_buffer), state.water_texture_pos.w*state.water_texture_pos.h*4);
 
-  // create transparent block vbo
+  // create transparent block pipeline
   state.transparent_block_pipeline = state.opaque_block_pipeline;
-  state.transparent_block_vb = VertexBuffer::create(world_object_vertex_spec, ARRAY_LEN(world_object_vertex_spec), true);
-  state.transparent_block_pipeline.vb = &state.transparent_block_vb;
-  state.transparent_block_pipeline.render_flags |= RENDERFLAG_BLEND;
+  state.transparent_block_pipeline.vb = &state.block_vbs[1][0][0];
+  state.transparent_block_pipeline.framebuffer = &state.transparency_framebuffer;
+  state.transparent_block_pipeline.render_flags |= RENDERFLAG_BLEND_WEIGHTED | RENDERFLAG_NO_DEPTH_WRITE;
 }
 
 static void shadowmap_init() {
@@ -3173,6 +6150,24 @@ static void post_processing_init() {
   state.post_processing_pipeline.num_textures = 4;
   state.post_processing_pipeline.vb = &state.quad_vb;
   state.post_processing_pipeline.framebuffer = &state.screen_framebuffer;
+
+  // transparency targets. They share the depth of the gbuffer, so transparent blocks behind opaque ones are hidden
+  state.transparency_accum_target = Texture::create_empty(GL_TEXTURE_2D, GL_RGBA16F, GL_RGBA, w, h);
+  state.transparency_weight_target = Texture::create_empty(GL_TEXTURE_2D, GL_R16F, GL_RED, w, h);
+  Texture transparency_targets[] = {state.transparency_accum_target, state.transparency_weight_target};
+  state.transparency_framebuffer = FrameBuffer::create(transparency_targets, ARRAY_LEN(transparency_targets), &state.gbuffer_depth_target);
+  state.transparency_composite_framebuffer = FrameBuffer::create(&state.gbuffer_color_target, 1, 0);
+
+  state.transparency_shader = Shader::create_from_string(transparency_vertex_shader, transparency_fragment_shader);
+  state.transparency_pipeline.shader = &state.transparency_shader;
+  state.transparency_pipeline.shader->set("u_accum", 0);
+  state.transparency_pipeline.shader->set("u_weight", 1);
+  state.transparency_pipeline.textures[0] = &state.transparency_accum_target;
+  state.transparency_pipeline.textures[1] = &state.transparency_weight_target;
+  state.transparency_pipeline.num_textures = 2;
+  state.transparency_pipeline.vb = &state.quad_vb;
+  state.transparency_pipeline.framebuffer = &state.transparency_composite_framebuffer;
+  state.transparency_pipeline.render_flags = RENDERFLAG_BLEND;
 }
 
 static void ui_graphics_init() {
@@ -3180,7 +6175,7 @@ static void ui_graphics_init() {
     VERTEXDATA_FLOAT(QuadVertex, pos),
     VERTEXDATA_FLOAT(QuadVertex, tex)
   };
-  state.quad_vb = VertexBuffer::create(vspec, ARRAY_LEN(vspec), true);
+  state.quad_vb = VertexBuffer::create_quads(vspec, ARRAY_LEN(vspec));
   state.quad_shader = Shader::create_from_string(ui_vertex_shader, ui_fragment_shader);
   state.ui_pipeline.vb = &state.quad_vb;
   state.ui_pipeline.shader = &state.quad_shader;
@@ -3351,20 +6346,37 @@ static void skybox_init() {
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);  
 }
 
+static void clouds_init() {
+  // a quad from -1 to 1, that the vertex shader moves to the camera and scales up
+  struct CloudVertex {
+    v2 pos;
+  };
+  CloudVertex vertices[] = {
+    -1.0f, -1.0f,
+     1.0f, -1.0f,
+     1.0f,  1.0f,
+    -1.0f,  1.0f,
+  };
+  VertexDataSpec vspec[] = {VERTEXDATA_FLOAT(CloudVertex, pos)};
+  state.cloud_vb = VertexBuffer::create_quads(vspec, ARRAY_LEN(vspec));
+  state.cloud_vb.set_vbo_data(vertices, ARRAY_LEN(vertices), GL_STATIC_DRAW);
+  state.cloud_pipeline.vb = &state.cloud_vb;
+
+  state.cloud_shader = Shader::create_from_string(cloud_vertex_shader, cloud_fragment_shader);
+  state.cloud_pipeline.shader = &state.cloud_shader;
+  state.cloud_pipeline.shader->set("u_height", (float)WORLD_CLOUD_HEIGHT);
+
+  // clouds are transparent, and seen from both above and below
+  state.cloud_pipeline.framebuffer = &state.transparency_framebuffer;
+  state.cloud_pipeline.render_flags = RENDERFLAG_DEPTH_TEST | RENDERFLAG_BLEND_WEIGHTED | RENDERFLAG_NO_DEPTH_WRITE;
+}
+
 static void push_quad(v2 x, v2 w, v2 t, v2 tw) {
-  const int e = state.quad_vertices.size;
   QuadVertex *v = array_pushn(state.quad_vertices, 4);
   *v++ = {x.x,     x.y,     t.x,      t.y};
   *v++ = {x.x+w.x, x.y,     t.x+tw.x, t.y};
   *v++ = {x.x+w.x, x.y+w.y, t.x+tw.x, t.y+tw.y};
   *v++ = {x.x,     x.y+w.y, t.x,      t.y+tw.y};
-  uint *el = array_pushn(state.quad_elements, 6);
-  *el++ = e+0;
-  *el++ = e+1;
-  *el++ = e+2;
-  *el++ = e+0;
-  *el++ = e+2;
-  *el++ = e+3;
 }
 
 struct KeyFrame {
@@ -3397,10 +6409,12 @@ static void shutdown(int code) {
   #ifdef VR_ENABLED
   shutdown_vr();
   #endif
+  mesh_cache_flush();
 
   exit(code);
 }
 
+#ifndef BENCH_ONLY
 // fills out the input fields in GameState
 static void read_input() {
   // clear earlier events
@@ -3463,6 +6477,7 @@ static void read_input() {
   if (state.mouse_clicked && state.mouse_clicked_right)
     state.mouse_clicked = false;
 }
+#endif
 
 #ifdef VR_ENABLED
 static void read_vr_input() {
@@ -3504,6 +6519,12 @@ static void update_player(float dt) {
   if (state.mouse_dx) camera_turn(&state.camera, state.mouse_dx * turn_sensitivity * dt);
   if (state.mouse_dy) camera_pitch(&state.camera, -state.mouse_dy * pitch_sensitivity * dt);
 
+  // you can look around while the world loads, but not move, see @startup
+  if (!state.startup.playable) {
+    state.camera_pos = state.player.pos + CAMERA_OFFSET_FROM_PLAYER;
+    return;
+  }
+
   bool in_water = get_blocktype(pos_to_block(state.player.pos)) == BLOCKTYPE_WATER;
 
   // move player, accountng for drag and stuff, or if the player is flying
@@ -3627,109 +6648,324 @@ static void update_player(float dt) {
   }
 }
 
-static void update_blocks(v3 before, v3 after) {
-  const BlockRange r0 = pos_to_range(before);
-  const BlockRange r1 = pos_to_range(after);
+// @prefetch
+// Sections are loaded when they come into the load area, but the block loader takes a while to get to them, so when
+// the player flies fast they can get there before it, and see holes. So we also load the load area around where the
+// player will be when the block loader has caught up: their velocity times how long the work it has left takes, at the
+// speed we have seen it go. What it gets to first is up to update_block_loader_jobs, which puts what is in front of
+// the camera first. The prefetch can be at most the unload margin, since that is how much room the range around the
+// player has, and then what we prefetch is also in what is kept loaded (see @residency)
+#define PREFETCH_MIN_MS 100.0f // we look at least this far ahead, since sections are remeshed after they are loaded
+
+// the prefetch, cut down so that it fits with some view distance
+static v3i prefetch_lead(v3i prefetch, int view_distance) {
+  const int m = unload_margin(view_distance);
+  const float xy = sqrtf((float)(prefetch.x*prefetch.x + prefetch.y*prefetch.y));
+  const float scale = xy > m ? m/xy : 1.0f;
+  return {(int)(prefetch.x*scale), (int)(prefetch.y*scale), clamp(prefetch.z, -m, m)};
+}
+
+// Measure how fast the block loader is, and return how far ahead of the player to load. Call once per frame.
+// The speed is in blocks per millisecond of wall clock time that it was busy, with all of its commands together, since
+// they don't go faster with more workers if they wait for each other on state.block_loader.lock
+static v3i update_prefetch() {
+  static u32 last_blocks, last_us;
+  spin_lock(&state.block_loader.busy_lock);
+  const u32 blocks = state.block_loader.blocks_done;
+  u32 us = state.block_loader.busy_us;
+  if (state.block_loader.num_running)
+    us += (u32)((mine_performance_counter() - state.block_loader.busy_since)*1000000/mine_performance_frequency());
+  spin_unlock(&state.block_loader.busy_lock);
+  float &blocks_per_ms = state.block_loader.blocks_per_ms;
+  if (us != last_us && blocks != last_blocks) {
+    const float speed = (blocks - last_blocks)*1000.0f/(us - last_us);
+    blocks_per_ms = blocks_per_ms ? lerp(0.05f, blocks_per_ms, speed) : speed;
+    last_blocks = blocks;
+    last_us = us;
+  }
 
-  if (r0.a.x == r1.a.x && r0.a.y == r1.a.y && r0.a.z == r1.a.z)
-    return;
+  // the loads and unloads it hasn't done yet
+  int blocks_left = atomic_get(&state.block_loader.blocks_queued);
+  for (int i = 0; i < state.block_loader.jobs.size; ++i)
+    blocks_left += block_loader_job_blocks(state.block_loader.jobs[i]);
+  const float ms = PREFETCH_MIN_MS + (blocks_per_ms ? blocks_left/blocks_per_ms : 0.0f);
 
-  state.block_vertices_dirty = true;
+  // the velocity is in blocks per 60th of a second, see update_player
+  const v3 ahead = state.player.vel*(ms*60.0f/1000.0f);
+  return prefetch_lead({(int)ahead.x, (int)ahead.y, (int)ahead.z}, state.world.view_distance);
+}
 
-  // unload blocks that went out of scope
-  // TODO:, FIXME: if we jumped farther than NUM_BLOCKS_x this probably breaks
-  // TODO:, FIXME: if the block loader is too far behind, the caches (like blocktype cache)
-  //               might wrap around and probably starts breaking stuff. (probably won't happen as long as
-  //               we keep the command buffer as small as it is at the moment)
-
-  // get blocks that went out of range
-  #define GET_EXITED_BLOCKS(DIM, r0, r1, result) \
-      (result) = (r0); \
-      if ((r0).a.DIM < (r1).a.DIM) { \
-        (result).b.DIM = (r1).a.DIM-1; \
-        (r0).a.DIM = (r1).a.DIM; \
-      } else { \
-        (result).a.DIM = (r1).b.DIM+1; \
-        (r0).b.DIM = (r1).b.DIM; \
-      }
+static bool same_section(Block a, Block b) {
+  return (a.x >> SECTION_SIZE_BITS) == (b.x >> SECTION_SIZE_BITS) &&
+         (a.y >> SECTION_SIZE_BITS) == (b.y >> SECTION_SIZE_BITS) &&
+         (a.z >> SECTION_SIZE_BITS) == (b.z >> SECTION_SIZE_BITS);
+}
 
-  // get blocks that went into range
-  #define GET_ENTERED_BLOCKS(DIM, r0, r1, result) \
-    (result) = (r1); \
-    if ((r1).a.DIM < (r0).a.DIM) { \
-      (result).b.DIM = (r0).a.DIM-1; \
-      (r1).a.DIM = (r0).a.DIM; \
-    } else { \
-      (result).a.DIM = (r0).b.DIM+1; \
-      (r1).b.DIM = (r0).b.DIM; \
-    }
+// @residency
+// Sections are loaded when they come into the load area (see @loadarea), but they are only unloaded once they are
+// unload_margin() blocks outside of it, so that walking back and forth over the border of a section doesn't load and
+// unload the same sections over and over. Sections that do go that far are retained: their blocks and faces are left
+// where they are, and only the MAX_RETAINED_SECTIONS that left the longest ago are actually unloaded. If the player
+// comes back before that, the section is just taken back, without any work for the block loader.
+// Which sections are loaded is decided here, on the main thread, and the block loader jobs follow it (see update_block_loader_jobs)
 
-  #define RANGE_IS_OK(r) ((r).a.x <= (r).b.x || (r).a.y <= (r).b.y || (r).a.z <= (r).b.z)
+static void unload_section(Section *s) {
+  const Block a = s->resident;
+  push_block_loader_command({BlockLoaderCommand::UNLOAD_BLOCK, {a, a + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1}}});
+  s->residency = SECTION_UNLOADED;
+}
 
-  // unload blocks that went out of range
-  #define PUSH_BLOCK_UNLOAD(DIM) \
-    if (r0_tmp.a.DIM != r1_tmp.a.DIM) { \
-      GET_EXITED_BLOCKS(DIM, r0_tmp, r1_tmp, r); \
-      if (RANGE_IS_OK(r)) \
-        push_block_loader_command({BlockLoaderCommand::UNLOAD_BLOCK, r}); \
+static void remove_retained_section(Block origin) {
+  Array<Block> &retained = state.world.retained;
+  for (int i = retained.size-1; i >= 0; --i) {
+    if (retained[i] == origin) {
+      array_remove_slow(retained, i);
+      return;
     }
-
-  {
-    BlockRange r0_tmp = r0;
-    BlockRange r1_tmp = r1;
-    BlockRange r;
-
-    PUSH_BLOCK_UNLOAD(x);
-    PUSH_BLOCK_UNLOAD(y);
-    PUSH_BLOCK_UNLOAD(z);
   }
+}
 
-  // load the new blocks that went into scope
-  #define PUSH_BLOCK_LOAD(DIM) \
-    if (r0_tmp.a.DIM != r1_tmp.a.DIM) { \
-      GET_ENTERED_BLOCKS(DIM, r0_tmp, r1_tmp, r); \
-      if (RANGE_IS_OK(r)) \
-        push_block_loader_command({BlockLoaderCommand::LOAD_BLOCK, r}); \
-    }
-
-  {
-    BlockRange r0_tmp = r0;
-    BlockRange r1_tmp = r1;
-    BlockRange r;
-
-    PUSH_BLOCK_LOAD(x);
-    PUSH_BLOCK_LOAD(y);
-    PUSH_BLOCK_LOAD(z);
-  }
-
-  // Reset world xy cache
-  #if 1
-  if (false) {
-    BlockRange r0_tmp = r0;
-    BlockRange r1_tmp = r1;
-    BlockRange r;
-
-    // x
-    if (r0_tmp.a.x != r1_tmp.a.x) {
-      GET_EXITED_BLOCKS(x, r0_tmp, r1_tmp, r);
-      if (RANGE_IS_OK(r)) {
-        for (int x = r0.a.x; x <= r1.b.x; ++x)
-        for (int y = r0.a.y; x <= r1.b.y; ++y)
-          clear_world_xy_cache(block_to_blockindex({x, y, 0}));
+// Queue loads and unloads for the sections, now that the player went from p0 with the view distance d0 to p1 with the
+// view distance d1. A view distance of 0 has nothing in its load area. The load area around p1 + the prefetch is also
+// loaded (see @prefetch)
+static void push_load_area_changes(Block p0, int d0, Block p1, int d1) {
+  // All loaded sections are kept in the load area of (p0, d0) grown by the unload margin, so they are inside its range,
+  // and the range of (p1, d1) has all of the ones that should be loaded now. So these are the only sections that can change
+  const v3i r0 = range_radius(d0), r1 = range_radius(d1);
+  const BlockRange r = {
+    {min(p0.x - r0.x, p1.x - r1.x), min(p0.y - r0.y, p1.y - r1.y), min(p0.z - r0.z, p1.z - r1.z)},
+    {max(p0.x + r0.x, p1.x + r1.x) - 1, max(p0.y + r0.y, p1.y + r1.y) - 1, max(p0.z + r0.z, p1.z + r1.z) - 1}
+  };
+  const int margin = unload_margin(d1);
+  const Block ahead = p1 + prefetch_lead(state.world.prefetch, d1);
+
+  // retain the sections that went too far first, so that when a section is loaded, whatever else is in its part of
+  // the cache is retained, and can be unloaded to make room for it
+  for (int pass = 0; pass < 2; ++pass)
+  for (int sx = r.a.x >> SECTION_SIZE_BITS; sx <= r.b.x >> SECTION_SIZE_BITS; ++sx)
+  for (int sy = r.a.y >> SECTION_SIZE_BITS; sy <= r.b.y >> SECTION_SIZE_BITS; ++sy)
+  for (int sz = r.a.z >> SECTION_SIZE_BITS; sz <= r.b.z >> SECTION_SIZE_BITS; ++sz) {
+    const Block a = {sx*SECTION_SIZE, sy*SECTION_SIZE, sz*SECTION_SIZE};
+    Section *s = get_section(block_to_blockindex(a));
+
+    if (pass == 0) {
+      if (s->residency == SECTION_LOADED && s->resident == a && !load_area_contains_section(p1, d1, a, margin)) {
+        s->residency = SECTION_RETAINED;
+        // if it's remeshed while it's retained, it can lose faces, see remesh_blocktype
+        s->retained_remesh = s->dirty_blocks != 0;
+        array_push(state.world.retained, a);
       }
+      continue;
     }
 
-    // y
-    if (r0_tmp.a.y != r1_tmp.a.y) {
-      GET_EXITED_BLOCKS(y, r0_tmp, r1_tmp, r);
-      if (RANGE_IS_OK(r)) {
-        for (int x = r0.a.x; x <= r1.b.x; ++x)
-        for (int y = r0.a.y; x <= r1.b.y; ++y)
-          clear_world_xy_cache(block_to_blockindex({x, y, 0}));
+    if (!load_area_contains_section(p1, d1, a) && !load_area_contains_section(ahead, d1, a))
+      continue;
+    if (section_is_resident(a)) {
+      if (s->residency == SECTION_RETAINED) {
+        s->residency = SECTION_LOADED;
+        remove_retained_section(a);
+        ++state.world.num_reloads_avoided;
+        if (s->retained_remesh)
+          request_remesh({a, a + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1}}, false);
       }
+      continue;
+    }
+    // make room for it. Everything that is loaded is closer than a cache width, so this is always a retained section
+    if (s->residency != SECTION_UNLOADED) {
+      remove_retained_section(s->resident);
+      unload_section(s);
     }
+    push_block_loader_command({BlockLoaderCommand::LOAD_BLOCK, {a, a + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1}}});
+    s->resident = a;
+    s->residency = SECTION_LOADED;
   }
-  #endif
+
+  // unload the sections that have been retained the longest
+  Array<Block> &retained = state.world.retained;
+  const int num_unloaded = max(retained.size - MAX_RETAINED_SECTIONS, 0);
+  for (int i = 0; i < num_unloaded; ++i)
+    unload_section(get_section(block_to_blockindex(retained[i])));
+  array_remove_slown(retained, 0, num_unloaded);
+}
+
+// @viewdistance
+// The view distance decides how big the block caches are, so it decides most of the memory we use. It can be set with
+// --view-distance, or picked as the largest one that fits in --ram-budget and --vram-budget (in MB), and changed at
+// runtime with page up and page down
+
+// Rough numbers for what a view distance costs, from what --bench-mesh sees at a few places, with room for hillier places
+#define FACES_PER_COLUMN 3 // visible block faces per column of blocks in the load area
+#define SECTIONS_WITH_FACES_PER_COLUMN 3 // sections with visible faces per column of sections in the load area
+
+// how many blocks the caches cover along x and y with some view distance. Twice the range around the player, and a power
+// of two so we can wrap around it with a mask
+static int block_cache_width(int view_distance) {
+  int n = SECTION_SIZE;
+  while (n < 4*view_distance)
+    n *= 2;
+  return n;
+}
+
+// about how much memory the world takes with some view distance, in bytes
+static void view_distance_memory(int view_distance, u64 *ram, u64 *vram) {
+  const u64 n = block_cache_width(view_distance);
+  // what is kept loaded, plus the retained sections, which we count as if they all had faces
+  const double kept = view_distance + unload_margin(view_distance);
+  const double columns = PI*kept*kept;
+  const u64 faces = (u64)(columns*FACES_PER_COLUMN) + MAX_RETAINED_SECTIONS*SECTION_SIZE*SECTION_SIZE*FACES_PER_COLUMN/SECTIONS_WITH_FACES_PER_COLUMN;
+  const u64 sections_with_faces = (u64)(columns/(SECTION_SIZE*SECTION_SIZE)*SECTIONS_WITH_FACES_PER_COLUMN) + MAX_RETAINED_SECTIONS;
+  const u64 face_bytes = 4*sizeof(WorldObjectVertex);
+  *ram =
+    n*n*NUM_BLOCKS_z + // block_types
+    n*n*sizeof(WorldXYCacheEntry) +
+    n*n/(SECTION_SIZE*SECTION_SIZE)*NUM_SECTIONS_z*sizeof(Section) +
+    sections_with_faces*SECTION_NUM_FACES*sizeof(int) + // face_slots
+    faces*(face_bytes + sizeof(u32)); // the block meshes keep the vertices and the key of each face
+  *vram = faces*face_bytes;
+}
+
+// the view distance closest to view_distance that we allow, and that fits in the memory budgets
+static int clamp_view_distance(int view_distance) {
+  int max_distance = MAX_VIEW_DISTANCE;
+  for (; max_distance > MIN_VIEW_DISTANCE; max_distance -= SECTION_SIZE) {
+    u64 ram, vram;
+    view_distance_memory(max_distance, &ram, &vram);
+    if ((!state.world.ram_budget || ram <= (u64)state.world.ram_budget << 20) && (!state.world.vram_budget || vram <= (u64)state.world.vram_budget << 20))
+      break;
+  }
+  return clamp(view_distance/SECTION_SIZE*SECTION_SIZE, MIN_VIEW_DISTANCE, max_distance);
+}
+
+// Throw away everything in the block caches and the faces of the blocks, and make the caches fit view_distance.
+// The block loader must not be working on anything. Main thread only
+static void reset_block_cache(int view_distance) {
+  const int old_num_sections = state.world.num_blocks_xy*state.world.num_blocks_xy/(SECTION_SIZE*SECTION_SIZE)*NUM_SECTIONS_z;
+  for (int i = 0; i < old_num_sections; ++i) {
+    free(state.world.sections[i].face_slots);
+    free(state.world.sections[i].dirty_blocks);
+  }
+  state.remesh.queue.size = 0;
+  state.remesh.requests.size = 0;
+  state.world.retained.size = 0;
+  spin_lock(&state.block_loader.remesh_lock);
+  state.block_loader.remesh_requests.size = 0;
+  spin_unlock(&state.block_loader.remesh_lock);
+  reset_block_vertices();
+  free(state.world.block_types);
+  free(state.world.xy_cache);
+  free(state.world.sections);
+
+  const int n = block_cache_width(view_distance);
+  const int num_sections = n*n/(SECTION_SIZE*SECTION_SIZE)*NUM_SECTIONS_z;
+  state.world.view_distance = view_distance;
+  state.world.num_blocks_xy = n;
+  // all of these start out as zero, which is BLOCKTYPE_NULL, an xy cache entry that was never written, and an unloaded section without faces
+  state.world.block_types = (u8*)calloc((size_t)n*n*NUM_BLOCKS_z, 1);
+  state.world.xy_cache = (WorldXYCacheEntry*)calloc((size_t)n*n, sizeof(*state.world.xy_cache));
+  state.world.sections = (Section*)calloc(num_sections, sizeof(*state.world.sections));
+  if (!state.world.block_types || !state.world.xy_cache || !state.world.sections)
+    die("Failed to allocate the block cache for view distance %i", view_distance);
+
+  u64 ram, vram;
+  view_distance_memory(view_distance, &ram, &vram);
+  printf("view distance %i: the block cache is %ix%ix%i blocks, and the world takes about %i MB of ram and %i MB of vram\n",
+         view_distance, n, n, NUM_BLOCKS_z, (int)(ram >> 20), (int)(vram >> 20));
+}
+
+// Throw away everything in the block cache, and queue all of the load area around the player for the block loader.
+// The block loader writes to the cache, so we let it finish the commands it was given first (and help it), which is
+// about a frame of work (see BLOCK_LOADER_MAX_QUEUED_BLOCKS). The jobs it wasn't given yet are for the old cache, and
+// are dropped. Main thread only
+static void reload_block_cache(int view_distance) {
+  state.block_loader.jobs.size = 0;
+  while (atomic_get(&state.block_loader.commands_running) > 0)
+    if (!run_one_block_loader_command())
+      mine_yield();
+  reset_block_cache(view_distance);
+  const Block p = pos_to_block(state.player.pos);
+  push_load_area_changes(p, 0, p, view_distance);
+}
+
+// Change the view distance at runtime. If the block cache stays the same size, the sections that went in or out of
+// the load area are loaded or unloaded, like when the player moves. Otherwise the cache is thrown away, and all of
+// the load area is loaded again. Either way it is the block loader that does it. Main thread only
+static void set_view_distance(int view_distance) {
+  view_distance = clamp_view_distance(view_distance);
+  const int before = state.world.view_distance;
+  if (view_distance == before)
+    return;
+
+  const Block p = pos_to_block(state.player.pos);
+  if (block_cache_width(view_distance) == state.world.num_blocks_xy) {
+    state.world.view_distance = view_distance;
+    push_load_area_changes(p, before, p, view_distance);
+    printf("view distance %i\n", view_distance);
+  } else {
+    reload_block_cache(view_distance);
+  }
+
+  set_lod_level_distances(state.world.view_distance);
+  state.farz = far_plane_distance();
+  state.post_processing_shader.set("u_far", state.farz);
+  set_fog();
+}
+
+// @teleport
+// When the player moves farther than the view distance at once, loading and unloading the difference like we do when
+// they walk would go through a lot of sections, and the old place and the new one could share parts of the block cache
+// until the block loader caught up. So we start over instead, like at startup: the cache is emptied, the load area
+// around the new place is queued (closest first, see update_block_loader_jobs), and the player is held there until
+// the world around them is loaded (see @startup).
+// We don't build the new place in a second block cache while the old one is still shown, and swap when it's ready:
+// that would need a second set of block types, sections and block meshes, which doubles the ram and vram of the
+// world (the block types alone are 512 MB at MAX_VIEW_DISTANCE) and what the memory budgets have to leave room for,
+// while the player would wait about as long for the new place either way, since it's loaded closest first
+// The teleport key is for testing this, so it only works when the game is started with --teleport-key
+#define TELEPORT_KEY_DISTANCE 10000 // how far the teleport key takes you
+
+// put the player on the ground at (x,y). The next update_blocks takes care of the world
+static void teleport(int x, int y) {
+  const WorldXYData xy_data = generate_xy_data(x, y);
+  state.player.pos = {x + 0.5f, y + 0.5f, max(xy_data.groundlevel, WORLD_WATER_LEVEL) + 0.1f};
+  state.player.vel = {};
+}
+
+static void update_blocks(v3 before, v3 after) {
+  const Block p0 = pos_to_block(before);
+  const Block p1 = pos_to_block(after);
+
+  if (max(max(abs(p1.x - p0.x), abs(p1.y - p0.y)), abs(p1.z - p0.z)) > state.world.view_distance) {
+    printf("teleport: from %i %i %i to %i %i %i\n", p0.x, p0.y, p0.z, p1.x, p1.y, p1.z);
+    reload_block_cache(state.world.view_distance);
+    state.startup.start = mine_performance_counter();
+    state.startup.playable = false;
+    state.startup.teleported = true;
+    return;
+  }
+
+  // the prefetch changes a little almost every frame, with the velocity and the speed of the block loader, so while
+  // the player stays in the same block we only take the new one when the place ahead of them goes into another section
+  const v3i prefetch = update_prefetch();
+  if (p0 == p1 && same_section(p1 + state.world.prefetch, p1 + prefetch))
+    return;
+  state.world.prefetch = prefetch;
+
+  // TODO:, FIXME: if the block loader is too far behind, the caches (like blocktype cache)
+  //               might wrap around and probably starts breaking stuff. (probably won't happen as long as
+  //               the loader keeps up, see the block loader stats in debug_prints)
+  push_load_area_changes(p0, state.world.view_distance, p1, state.world.view_distance);
+}
+
+// move faces into the holes of the block meshes, a bit every frame, so that draw cost follows the number
+// of faces that are shown rather than the most faces we ever had
+static void defragment_block_meshes() {
+  const int MAX_MOVES_PER_FRAME = 8192;
+
+  int moves = 0;
+  for (int t = 0; t < 2; ++t)
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS && moves < MAX_MOVES_PER_FRAME; ++i)
+    moves += compact_block_mesh(state.block_meshes[t][d][i], MAX_MOVES_PER_FRAME - moves);
 }
 
 static void update_weather() {
@@ -3742,8 +6978,42 @@ static void debug_prints(int loopindex, float dt) {
     if (loopindex%100 == 0)
       printf("fps: %f\n", dt*60.0f);
     // printf("player pos: %f %f %f\n", state.player.pos.x, state.player.pos.y, state.player.pos.z);
-    // printf("num_block_vertices: %lu\n", state.num_block_vertices*sizeof(state.block_vertices[0]));
-    // printf("num free block faces: %i/%lu\n", state.num_free_faces, ARRAY_LEN(state.free_faces));
+    if (loopindex%100 == 0) {
+      const BlockMeshTotals opaque = block_mesh_totals(false), transparent = block_mesh_totals(true);
+      printf("block mesh fragmentation: opaque %.1f%% (%i holes, %i slots), transparent %.1f%% (%i holes, %i slots)\n",
+             block_mesh_fragmentation(opaque)*100.0f, opaque.holes, opaque.faces,
+             block_mesh_fragmentation(transparent)*100.0f, transparent.holes, transparent.faces);
+    }
+    if (loopindex%100 == 0)
+      printf("remesh: %i sections this frame, %i queued\n", state.remesh.sections_this_frame, state.remesh.queue.size);
+    if (loopindex%100 == 0)
+      printf("block loader: %i commands queued (at most %i) covering %i blocks, %i jobs waiting, the queue was full %i times, "
+             "%i jobs cancelled, %i coalesced\n",
+             block_loader_commands_queued(), atomic_get(&state.block_loader.max_commands_queued),
+             atomic_get(&state.block_loader.blocks_queued), state.block_loader.jobs.size, atomic_get(&state.block_loader.num_full),
+             state.block_loader.num_cancelled, state.block_loader.num_coalesced);
+    if (loopindex%100 == 0)
+      printf("residency: %i sections retained, %i came back before they were unloaded\n", state.world.retained.size, state.world.num_reloads_avoided);
+    if (loopindex%100 == 0)
+      printf("tasks: %i workers, %i tasks were stolen\n", state.tasks.num_workers, atomic_get(&state.tasks.num_stolen));
+    if (loopindex%100 == 0)
+      printf("prefetch: %i %i %i blocks ahead, the block loader does %.0f blocks/ms\n",
+             state.world.prefetch.x, state.world.prefetch.y, state.world.prefetch.z, state.block_loader.blocks_per_ms);
+    if (loopindex%100 == 0)
+      printf("block loader lock: the block loader waited %.1f us at p99 (%.1f us at most) and held it %.1f us at p99 (%.1f us at most), "
+             "the main thread waited %.1f us at p99 (%.1f us at most) and held it %.1f us at p99 (%.1f us at most)\n",
+             lock_times_percentile(&state.block_loader.loader_lock_wait, 0.99f), lock_times_max(&state.block_loader.loader_lock_wait),
+             lock_times_percentile(&state.block_loader.loader_lock_hold, 0.99f), lock_times_max(&state.block_loader.loader_lock_hold),
+             lock_times_percentile(&state.block_loader.main_lock_wait, 0.99f), lock_times_max(&state.block_loader.main_lock_wait),
+             lock_times_percentile(&state.block_loader.main_lock_hold, 0.99f), lock_times_max(&state.block_loader.main_lock_hold));
+    if (loopindex%100 == 0 && state.lod.enabled) {
+      // the terrain threads pop requests, so look at the queues under their lock
+      spin_lock(&state.lod.lock);
+      const int lod_queued = state.lod.queue.requests.size - state.lod.queue.requests_head;
+      const int far_terrain_queued = state.far_terrain.queue.requests.size - state.far_terrain.queue.requests_head;
+      spin_unlock(&state.lod.lock);
+      printf("lod: %i chunks queued, far terrain: %i tiles queued\n", lod_queued, far_terrain_queued);
+    }
 
     // printf("items: ");
     // for (int i = 0; i < ARRAY_LEN(state.inventory.items); ++i)
@@ -3776,11 +7046,22 @@ static void update_water_texture(float dt) {
   glTexSubImage2D(GL_TEXTURE_2D, 0, state.water_texture_pos.x, state.water_texture_pos.y, state.water_texture_pos.w, state.water_texture_pos.h, GL_RGBA, GL_UNSIGNED_BYTE, state.water_texture_buffer);
 }
 
+static void update_clouds(float dt) {
+  state.cloud_offset.x += dt * 0.05f;
+  state.cloud_offset.y += dt * 0.02f;
+}
+
+// once per frame, since the tool is drawn once per eye in vr
+static void update_tool(float dt) {
+  state.tool_bob += dt * 0.07f;
+}
+
 static void update_inventory() {
   state.inventory.selected_item -= state.scrolled;
   state.inventory.selected_item = clamp(state.inventory.selected_item, 0, (int)ARRAY_LEN(state.inventory.items)-1);
 }
 
+#ifndef BENCH_ONLY
 static void sdl_init() {
   /* Fix for some builds of SDL 2.0.4, see https://bugs.gentoo.org/show_bug.cgi?id=610326 */
   #ifdef OS_LINUX
@@ -3824,26 +7105,222 @@ static void sdl_init() {
   SDL_GLContext glcontext = SDL_GL_CreateContext(state.window);
   if (!glcontext) die("Failed to create context: %s", SDL_GetError());
 }
+#endif
+
+// resend the parts of the block mesh that changed to the gpu
+static void upload_block_mesh(BlockMesh &mesh, VertexBuffer &vb) {
+  if (!mesh.dirty)
+    return;
+  mesh.dirty = false;
 
-static void render_transparent_blocks(const m4 &viewprojection) {
-  if (state.transparent_block_vertices_dirty) {
-    state.transparent_block_pipeline.vb->set_data(state.transparent_block_vertices.items, state.transparent_block_vertices.size, state.transparent_block_elements.items, state.transparent_block_elements.size);
-    state.transparent_block_vertices_dirty = false;
+  // if it doesn't fit, or we are wasting a lot of memory, reallocate and send everything
+  if (mesh.vertices.size > vb.vbo_capacity || mesh.vertices.cap < vb.vbo_capacity/4) {
+    vb.alloc_vbo<WorldObjectVertex>(mesh.vertices.cap);
+    vb.update_vbo_data(mesh.vertices.items, 0, mesh.vertices.size);
+  }
+  // otherwise just send the pages that changed, coalescing runs of them
+  else {
+    for (int i = 0; i < mesh.dirty_pages.size;) {
+      if (!mesh.dirty_pages[i]) {
+        ++i;
+        continue;
+      }
+      int j = i;
+      while (j < mesh.dirty_pages.size && mesh.dirty_pages[j])
+        ++j;
+      const int first = i*BLOCK_MESH_PAGE_FACES*4;
+      const int last = min(j*BLOCK_MESH_PAGE_FACES*4, mesh.vertices.size);
+      if (first < last)
+        vb.update_vbo_data(mesh.vertices.items, first, last - first);
+      i = j;
+    }
   }
+  vb.num_vertices = mesh.vertices.size;
+  array_zero(mesh.dirty_pages);
   gl_ok_or_die;
+}
 
-  state.transparent_block_pipeline.shader->set("u_viewprojection", viewprojection);
-  state.transparent_block_pipeline.render(state.transparent_block_elements.size);
+enum WorldClip {
+  WORLD_CLIP_NONE,
+  WORLD_CLIP_LOD_HOLE, // for full resolution blocks, so they don't overlap the lod chunks
+  WORLD_CLIP_LOD_CHUNKS, // for far terrain, so it doesn't overlap the lod chunks
+};
+
+// which parts of the world the world object shader should skip drawing
+static void set_world_clip(WorldClip c) {
+  v4 clip = {0.0f, 0.0f, 1e9f, (float)LOD_CHUNK_SIZE};
+  v4 lod_clip = {0.0f, 0.0f, 0.0f, (float)LOD_CHUNK_SIZE};
+  if (c == WORLD_CLIP_LOD_HOLE && state.lod.enabled) {
+    const LodHole hole = lod_hole();
+    clip = {(float)hole.x, (float)hole.y, (float)hole.r, (float)LOD_CHUNK_SIZE};
+  }
+  // same test as lod_chunk_level, as it was when the lod chunks last got their levels
+  if (c == WORLD_CLIP_LOD_CHUNKS && state.lod.enabled)
+    lod_clip = {state.lod.center_pos.x, state.lod.center_pos.y, lod_view_distance(), (float)LOD_CHUNK_SIZE};
+  state.world_object_shader.set("u_clip", clip);
+  state.world_object_shader.set("u_lod_clip", lod_clip);
+}
+
+static void render_lod_chunks() {
+  if (!state.lod.enabled)
+    return;
+
+  set_world_clip(WORLD_CLIP_NONE);
+  const LodHole hole = lod_hole();
+  RenderPipeline &pipeline = state.opaque_block_pipeline;
+  for (int x = 0; x < LOD_GRID_SIZE; ++x)
+  for (int y = 0; y < LOD_GRID_SIZE; ++y) {
+    LodChunk &c = state.lod.chunks[x][y];
+    if (!c.level || !c.wanted_level || !c.vb.num_vertices || lod_hole_contains(hole, c.x, c.y))
+      continue;
+    pipeline.vb = &c.vb;
+    pipeline.render();
+  }
+}
+
+// with the far terrain projection and depth range, see @depthranges
+static void render_far_terrain(const m4 &viewprojection) {
+  if (!state.far_terrain.enabled)
+    return;
+
+  set_world_clip(WORLD_CLIP_LOD_CHUNKS);
+  RenderPipeline &pipeline = state.opaque_block_pipeline;
+  pipeline.shader->set("u_viewprojection", viewprojection);
+  for (int x = 0; x < FAR_TERRAIN_GRID_SIZE; ++x)
+  for (int y = 0; y < FAR_TERRAIN_GRID_SIZE; ++y) {
+    LodChunk &c = state.far_terrain.tiles[x][y];
+    if (!c.level || !c.wanted_level || !c.vb.num_vertices)
+      continue;
+    pipeline.vb = &c.vb;
+    pipeline.render();
+  }
+}
+
+static void upload_block_meshes(bool transparent) {
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i)
+    upload_block_mesh(state.block_meshes[transparent][d][i], state.block_vbs[transparent][d][i]);
+}
+
+// the first block (along its axis) of a slab, in the loaded range that starts at a. The cache wraps around, see block_to_blockindex
+static int block_mesh_slab_start(int slab, int a, int num_blocks) {
+  int offset = (slab*SECTION_SIZE - a) & (num_blocks-1);
+  // the range starts in the middle of this slab
+  if (offset > num_blocks - SECTION_SIZE)
+    offset -= num_blocks;
+  return a + offset;
+}
+
+// Where the slabs are, for block_mesh_bucket_is_visible.
+// A slab is where block_mesh_slab_start puts it for all loaded sections, since they are all inside the range. But retained
+// sections (see @residency) can be left outside of it when the player moves on, in a part of the cache that wrapped
+// around, so their faces are somewhere else than the rest of their slab. We never cull those slabs.
+// Sections that were just unloaded keep their faces until the block loader gets to them, and those can be culled
+// by mistake for a few frames, but they are on their way out anyway
+struct BucketView {
+  BlockRange range;
+  bool wrapped_x[NUM_BLOCK_MESH_SLABS], wrapped_y[NUM_BLOCK_MESH_SLABS], wrapped_z[NUM_BLOCK_MESH_SLABS];
+};
+
+static BucketView bucket_view() {
+  BucketView v = {};
+  v.range = pos_to_range(state.player.pos);
+  For(state.world.retained) {
+    const Block a = *it;
+    const BlockIndex bi = block_to_blockindex(a);
+    const int sx = bi.x >> SECTION_SIZE_BITS, sy = bi.y >> SECTION_SIZE_BITS, sz = bi.z >> SECTION_SIZE_BITS;
+    if (block_mesh_slab_start(sx, v.range.a.x, state.world.num_blocks_xy) != a.x)
+      v.wrapped_x[sx] = true;
+    if (block_mesh_slab_start(sy, v.range.a.y, state.world.num_blocks_xy) != a.y)
+      v.wrapped_y[sy] = true;
+    if (block_mesh_slab_start(sz, v.range.a.z, NUM_BLOCKS_z) != a.z)
+      v.wrapped_z[sz] = true;
+  }
+  return v;
+}
+
+// whether any face in bucket [dir][slab] can face a camera at eye.
+// The DIRECTION_X face of block x is in the plane x+1, so it can only be seen from eye.x > x+1, and so on
+static bool block_mesh_bucket_is_visible(Direction dir, int slab, v3 eye, const BucketView &view) {
+  const BlockRange &range = view.range;
+  switch (dir) {
+    case DIRECTION_X:       return view.wrapped_x[slab] || eye.x > block_mesh_slab_start(slab, range.a.x, state.world.num_blocks_xy) + 1;
+    case DIRECTION_MINUS_X: return view.wrapped_x[slab] || eye.x < block_mesh_slab_start(slab, range.a.x, state.world.num_blocks_xy) + SECTION_SIZE - 1;
+    case DIRECTION_Y:       return view.wrapped_y[slab] || eye.y > block_mesh_slab_start(slab, range.a.y, state.world.num_blocks_xy) + 1;
+    case DIRECTION_MINUS_Y: return view.wrapped_y[slab] || eye.y < block_mesh_slab_start(slab, range.a.y, state.world.num_blocks_xy) + SECTION_SIZE - 1;
+    case DIRECTION_UP:      return view.wrapped_z[slab] || eye.z > block_mesh_slab_start(slab, range.a.z, NUM_BLOCKS_z) + 1;
+    case DIRECTION_DOWN:    return view.wrapped_z[slab] || eye.z < block_mesh_slab_start(slab, range.a.z, NUM_BLOCKS_z) + SECTION_SIZE - 1;
+    default: return true;
+  }
+}
+
+// draw the buckets of opaque or transparent faces that can face a camera at eye
+static void render_block_buckets(RenderPipeline &pipeline, bool transparent, v3 eye) {
+  const BucketView view = bucket_view();
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i) {
+    // skip the ones with nothing but holes (the first face is always the null face), they can still have vertices
+    // until compact_block_mesh gets to them
+    const BlockMesh &mesh = state.block_meshes[transparent][d][i];
+    if (mesh.face_keys.size - 1 - mesh.num_holes <= 0 || !block_mesh_bucket_is_visible((Direction)d, i, eye, view))
+      continue;
+    VertexBuffer &vb = state.block_vbs[transparent][d][i];
+    pipeline.vb = &vb;
+    pipeline.render();
+  }
 }
 
 static void flush_quads(const RenderPipeline &p) {
-  p.vb->bind();
-  gl_ok_or_die;
-  glBufferData(GL_ARRAY_BUFFER, state.quad_vertices.size*sizeof(*state.quad_vertices.items), state.quad_vertices.items, GL_DYNAMIC_DRAW);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, state.quad_elements.size*sizeof(*state.quad_elements.items), state.quad_elements.items, GL_DYNAMIC_DRAW);
+  p.vb->set_vbo_data(state.quad_vertices.items, state.quad_vertices.size);
   gl_ok_or_die;
-  p.render(state.quad_elements.size);
-  state.quad_vertices.size = state.quad_elements.size = 0;
+  p.render(p.vb->num_items());
+  state.quad_vertices.size = 0;
+}
+
+// only the parts of the clouds that are between min_distance and max_distance from eye
+static void render_clouds(const m4 &viewprojection, v3 eye, float min_distance, float max_distance) {
+  state.cloud_pipeline.shader->set("u_viewprojection", viewprojection);
+  state.cloud_pipeline.shader->set("u_distance_range", v2{min_distance, max_distance});
+  state.cloud_pipeline.shader->set("u_camerapos", eye);
+  state.cloud_pipeline.shader->set("u_size", view_distance());
+  state.cloud_pipeline.shader->set("u_offset", state.cloud_offset);
+  state.cloud_pipeline.shader->set("u_ambient", state.ambient_light);
+  state.cloud_pipeline.shader->set("u_skylight_color", state.diffuse_light);
+  state.cloud_pipeline.render();
+}
+
+// Transparent blocks use weighted blended order-independent transparency (http://jcgt.org/published/0002/02/09/),
+// so we never have to sort them, no matter how many there are or how they overlap.
+// Every transparent fragment is added to the transparency targets with a weight that falls off with distance,
+// and when all are drawn we put the weighted average color on top of the gbuffer color, by how much they cover.
+static void render_transparent_blocks(const m4 &viewprojection, const m4 &far_viewprojection, v3 eye) {
+  upload_block_meshes(true);
+
+  // no color and nothing covered
+  state.transparency_framebuffer.bind();
+  const float accum_clear[] = {0.0f, 0.0f, 0.0f, 1.0f};
+  const float weight_clear[] = {0.0f, 0.0f, 0.0f, 0.0f};
+  glClearBufferfv(GL_COLOR, 0, accum_clear);
+  glClearBufferfv(GL_COLOR, 1, weight_clear);
+
+  set_world_clip(WORLD_CLIP_LOD_HOLE);
+  state.transparent_block_pipeline.shader->set("u_viewprojection", viewprojection);
+  state.transparent_block_pipeline.shader->set("u_transparent", 1);
+  render_block_buckets(state.transparent_block_pipeline, true, eye);
+  state.transparent_block_pipeline.shader->set("u_transparent", 0);
+
+  // clouds are transparent too, so they go in with the blocks.
+  // They go out past the lod chunks, so the far part of them is drawn with the far terrain, see @depthranges
+  if (state.far_terrain.enabled) {
+    render_clouds(viewprojection, eye, 0.0f, lod_view_distance());
+    set_depth_range(DEPTH_RANGE_FAR);
+    render_clouds(far_viewprojection, eye, lod_view_distance(), 1e9f);
+  } else {
+    render_clouds(viewprojection, eye, 0.0f, 1e9f);
+  }
+
+  push_quad({0.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 0.0f}, {1.0f, 1.0f});
+  flush_quads(state.transparency_pipeline);
 }
 
 static void render_gbuffer_to_screen() {
@@ -3894,26 +7371,62 @@ static void render_shadowmap() {
   state.shadowmap_pipeline.shader->set("u_viewprojection", state.shadowmap_viewprojection);
 
   state.shadowmap_pipeline.framebuffer->clear();
-  state.shadowmap_pipeline.render(state.block_elements.size);
+
+  // only back faces are drawn into the shadowmap (see shadowmap_init), so skip the directions that face the sun
+  for (int d = 0; d < DIRECTION_MAX; ++d) {
+    if (direction_to_normal((Direction)d) * state.sun_direction < 0.0f)
+      continue;
+    for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i) {
+      VertexBuffer &vb = state.block_vbs[0][d][i];
+      if (vb.num_vertices <= 4)
+        continue;
+      state.shadowmap_pipeline.vb = &vb;
+      state.shadowmap_pipeline.render();
+    }
+  }
 }
 
-static void render_opaque_blocks(m4 viewprojection) {
+static void render_opaque_blocks(m4 viewprojection, v3 eye) {
   // render opaque blocks
   state.opaque_block_pipeline.shader->set("u_viewprojection", viewprojection);
-  state.opaque_block_pipeline.render(state.block_elements.size);
-}
-
-static void render_tool(const m4& proj) {
-  static float a;
-  a += 0.07f;
-  // TODO: properly create a model matrix instead of this hack
-  m4 v = camera_view_matrix(&state.camera, {-1.0f, -1.0f, sinf(a)*0.3f});
-  m4 vp = proj * v;
-
-  state.tool_pipeline.shader->set("u_camerapos", v3{0.0f, 0.0f, 0.0f});
-  state.tool_pipeline.shader->set("u_viewprojection", vp);
-  state.tool_pipeline.render();
-  state.tool_pipeline.shader->set("u_camerapos", state.camera_pos);
+  set_world_clip(WORLD_CLIP_LOD_HOLE);
+  render_block_buckets(state.opaque_block_pipeline, false, eye);
+
+  // and the lod chunks around them
+  render_lod_chunks();
+}
+
+// The tool is held down and to the right in front of the camera, and turns with it. The camera rotation matrix takes
+// world directions to the camera's (right, up, out of the screen), so its transpose takes the tool from the camera's
+// directions to the world's
+static void render_tool() {
+  m4 offset = m4_iden();
+  offset.d[3] = 0.6f;
+  offset.d[7] = -0.8f + sinf(state.tool_bob)*0.3f;
+  offset.d[11] = -1.5f;
+  m4 position = m4_iden();
+  position.d[3] = state.camera_pos.x;
+  position.d[7] = state.camera_pos.y;
+  position.d[11] = state.camera_pos.z;
+  push_voxel_model(state.tool_model, position * m4_transpose(camera_rotation_matrix(&state.camera)) * offset);
+}
+
+// draw all voxel models pushed this frame, one draw per model
+static void render_voxel_models(const m4 &viewprojection) {
+  RenderPipeline &pipeline = state.voxel_model_pipeline;
+  pipeline.shader->set("u_viewprojection", viewprojection);
+  pipeline.shader->set("u_instanced", 1);
+  set_world_clip(WORLD_CLIP_NONE);
+  for (int i = 0; i < state.num_voxel_models; ++i) {
+    VoxelModel &model = state.voxel_models[i];
+    if (!model.instances.size)
+      continue;
+    model.vb.set_instance_data(model.instances.items, model.instances.size);
+    pipeline.vb = &model.vb;
+    pipeline.render();
+    model.instances.size = 0;
+  }
+  pipeline.shader->set("u_instanced", 0);
 }
 
 static void render_skybox(const m4 &view, const m4 &proj) {
@@ -4009,58 +7522,92 @@ static void render_text() {
   state.text_vertices.size = 0;
 }
 
-static void block_loader_load_block(Block b) {
-  BlockType t = calc_blocktype(b);
+static void block_loader_load_block(Block b, const WorldXYData &xy_data) {
+  BlockType t = calc_blocktype(b, xy_data);
   set_blocktype_cache(b, t);
-  show_block_faces(b, t);
 }
 
 static void block_loader_unload_block(Block b) {
-  // We know the value should be in the cache since it hasn't been unloaded yet,
-  // so we go to the cache directly
-  BlockType t = get_blocktype_cache(b);
+  // clear cache. The faces of the block are removed when its section is remeshed
+  set_blocktype_cache(b, BLOCKTYPE_NULL);
+}
 
-  // remove the visible faces of this block
-  hide_block_faces(b, t);
+struct LoadAreaColumns {
+  Block p;
+  BlockRange range;
+  AtomicInt num_blocks;
+};
 
-  // clear cache
-  set_blocktype_cache(b, BLOCKTYPE_NULL);
+// load the columns of the load area from range.a.x + begin to range.a.x + end. Each column is only written by one task
+static void load_load_area_columns(void *data, int begin, int end) {
+  LoadAreaColumns *columns = (LoadAreaColumns*)data;
+  const Block p = columns->p;
+  const BlockRange &range = columns->range;
+  int num_blocks = 0;
+  for (int x = range.a.x + begin; x < range.a.x + end; ++x)
+  for (int y = range.a.y; y <= range.b.y; ++y) {
+    const WorldXYData xy_data = get_world_xy_data({x, y, 0});
+    for (int z = range.a.z & ~(SECTION_SIZE-1); z <= range.b.z; z += SECTION_SIZE) {
+      if (!load_area_contains_section(p, {x, y, z}))
+        continue;
+      // the blocks of a section along z are next to each other in the cache
+      u8 *row = get_block_cache(block_to_blockindex({x, y, z}));
+      for (int i = 0; i < SECTION_SIZE; ++i)
+        row[i] = (u8)calc_blocktype({x, y, z + i}, xy_data);
+      num_blocks += SECTION_SIZE;
+    }
+  }
+  atomic_add(&columns->num_blocks, num_blocks);
+}
+
+// Load all of the load area around the player (see @loadarea) right away, in tasks that we wait for, instead of
+// through the block loader, and queue it for remeshing. Returns how many blocks were loaded
+static int load_whole_load_area() {
+  const Block p = pos_to_block(state.player.pos);
+  const BlockRange range = pos_to_range(state.player.pos);
+  LoadAreaColumns columns = {};
+  columns.p = p;
+  columns.range = range;
+  parallel_for(range.b.x - range.a.x + 1, 4, load_load_area_columns, &columns);
+
+  for (int sx = range.a.x >> SECTION_SIZE_BITS; sx <= range.b.x >> SECTION_SIZE_BITS; ++sx)
+  for (int sy = range.a.y >> SECTION_SIZE_BITS; sy <= range.b.y >> SECTION_SIZE_BITS; ++sy)
+  for (int sz = range.a.z >> SECTION_SIZE_BITS; sz <= range.b.z >> SECTION_SIZE_BITS; ++sz) {
+    const Block a = {sx*SECTION_SIZE, sy*SECTION_SIZE, sz*SECTION_SIZE};
+    if (!load_area_contains_section(p, a))
+      continue;
+    Section *s = get_section(block_to_blockindex(a));
+    s->resident = a;
+    s->residency = SECTION_LOADED;
+    request_remesh({a, a + v3i{SECTION_SIZE-1, SECTION_SIZE-1, SECTION_SIZE-1}}, false);
+  }
+  return atomic_get(&columns.num_blocks);
 }
 
 static void generate_block_mesh() {
   printf("Loading world..");
   fflush(stdout);
-  int start_time = SDL_GetTicks();
+  const u64 start = mine_performance_counter();
 
   reset_block_vertices();
 
-  // render block faces that face transparent blocks
-  FOR_BLOCKS_IN_RANGE_x
-  FOR_BLOCKS_IN_RANGE_y
-  FOR_BLOCKS_IN_RANGE_z
-    block_loader_load_block({x,y,z});
+  load_whole_load_area();
+  update_remesh(INFINITY);
 
-  printf("Done loading world. It took %f seconds\n", (SDL_GetTicks() - start_time) / 1000.0f);
+  printf("Done loading world. It took %f seconds\n", (double)(mine_performance_counter() - start) / mine_performance_frequency());
+  if (state.mesh_cache.enabled) {
+    spin_lock(&state.mesh_cache.lock);
+    printf("mesh cache: %i hits, %i misses, %i bad entries, %i evicted, %i not saved\n", state.mesh_cache.hits, state.mesh_cache.misses,
+           state.mesh_cache.bad_entries, state.mesh_cache.evicted, state.mesh_cache.dropped);
+    spin_unlock(&state.mesh_cache.lock);
+  }
 }
 
-static int blockloader_thread(void*) {
-  for (;;) {
-    BlockLoaderCommand command = pop_block_loader_command();
-    SDL_AtomicLock(&state.block_loader.lock);
-    if (command.type == BlockLoaderCommand::UNLOAD_BLOCK) {
-      for (int x = command.range.a.x; x <= command.range.b.x; ++x)
-      for (int y = command.range.a.y; y <= command.range.b.y; ++y)
-      for (int z = command.range.a.z; z <= command.range.b.z; ++z)
-        block_loader_unload_block({x,y,z});
-    } else {
-      assert(command.type == BlockLoaderCommand::LOAD_BLOCK);
-      for (int x = command.range.a.x; x <= command.range.b.x; ++x)
-      for (int y = command.range.a.y; y <= command.range.b.y; ++y)
-      for (int z = command.range.a.z; z <= command.range.b.z; ++z)
-        block_loader_load_block({x,y,z});
-    }
-    SDL_AtomicUnlock(&state.block_loader.lock);
-  }
+// meshes lod chunks, and far terrain tiles when there are no lod chunks left to do
+static int terrain_thread(void*) {
+  for (;;)
+    if (!lod_process_request() && !far_terrain_process_request())
+      semaphore_wait(state.lod.wakeup);
 }
 
 static void gamestate_init() {
@@ -4068,27 +7615,25 @@ static void gamestate_init() {
 
   state.screen_framebuffer = FrameBuffer::create_default_framebuffer(state.screen_width, state.screen_height);
 
-  // TODO: might as well have a much larger value
-  state.block_vertex_pos.init(1024);
-
   // state.player.god_mode = true;
 
   state.fov = PI/2.0f;
   state.nearz = 0.3f;
-  state.farz = len(v3{(float)NUM_VISIBLE_BLOCKS_x, (float)NUM_VISIBLE_BLOCKS_y, (float)NUM_VISIBLE_BLOCKS_z});
+  // the view distance from the command line, or as far as fits in the memory budget, see @viewdistance
+  reset_block_cache(clamp_view_distance(state.world.view_distance));
+  set_lod_level_distances(state.world.view_distance);
+  state.farz = far_plane_distance();
   state.player.pos = {1000.0f, 1000.0f, 18.1f};
   camera_lookat(&state.camera, state.player.pos, state.player.pos + v3{0.0f, 1.0f, 0.0f});
-  state.block_vertices_dirty = true;
-  state.transparent_block_vertices_dirty = true;
   state.inventory.render_quickmenu = true;
   state.sun_angle = PI/4.0f;
 
-  state.block_loader.num_commands_free = SDL_CreateSemaphore(MAX_BLOCK_LOADER_COMMANDS);
-  if (!state.block_loader.num_commands_free)
-    sdl_die("Failed to intialize semaphores");
-  state.block_loader.num_commands = SDL_CreateSemaphore(0);
-  if (!state.block_loader.num_commands)
-    sdl_die("Failed to initialize semaphores");
+  // the workers run the block loader when they have no tasks, so there has to be at least one
+  state.tasks.background_work = run_one_block_loader_command;
+  tasks_init(max(mine_cpu_count() - 1, 1));
+  for (int i = 0; i < MAX_BLOCK_LOADER_COMMANDS; ++i)
+    atomic_set(&state.block_loader.commands[i].sequence, i);
+  state.lod.wakeup = semaphore_create();
 
   // fill inventory with a bunch of blocks
   for (int i = 0; i < min(BLOCKTYPES_MAX - 1 - BLOCKTYPE_AIR, (int)ARRAY_LEN(state.inventory.items)); ++i) {
@@ -4098,9 +7643,314 @@ static void gamestate_init() {
   }
 }
 
-static void world_init() {
+// @startup
+// The game doesn't load the world before the first frame. The load area is queued for the block loader like when
+// the player moves (see world_init), which loads what is closest first, and we draw frames while it does.
+// The player is held in place until the load area within SPAWN_READY_RADIUS of them is loaded and meshed
+#define SPAWN_READY_RADIUS 32
+// how many milliseconds per frame we spend remeshing while the player is held, since there isn't much else to do then
+#define STARTUP_REMESH_BUDGET_MS 8.0f
+
+static float startup_ms() {
+  return (mine_performance_counter() - state.startup.start) * 1000.0f / mine_performance_frequency();
+}
+
+static bool spawn_is_ready() {
+  const Block p = pos_to_block(state.player.pos);
+  const BlockRange r = {p - v3i{SPAWN_READY_RADIUS, SPAWN_READY_RADIUS, SPAWN_READY_RADIUS}, p + v3i{SPAWN_READY_RADIUS, SPAWN_READY_RADIUS, SPAWN_READY_RADIUS}};
+  for (int sx = r.a.x >> SECTION_SIZE_BITS; sx <= r.b.x >> SECTION_SIZE_BITS; ++sx)
+  for (int sy = r.a.y >> SECTION_SIZE_BITS; sy <= r.b.y >> SECTION_SIZE_BITS; ++sy)
+  for (int sz = r.a.z >> SECTION_SIZE_BITS; sz <= r.b.z >> SECTION_SIZE_BITS; ++sz) {
+    const Block a = {sx*SECTION_SIZE, sy*SECTION_SIZE, sz*SECTION_SIZE};
+    if (load_area_contains_section(p, a) && !get_section(block_to_blockindex(a))->meshed)
+      return false;
+  }
+  return true;
+}
+
+// let the player go once the world around them is there. Main thread only
+static void update_startup() {
+  if (state.startup.playable || !spawn_is_ready())
+    return;
+  state.startup.playable = true;
+  printf("%s: playable after %.0f ms, %i block loader jobs and %i remeshes left\n", state.startup.teleported ? "teleport" : "startup",
+         startup_ms(), state.block_loader.jobs.size, state.remesh.queue.size);
+}
+
+// With progressive, the world is only queued for the block loader, and shows up over the next frames (see @startup).
+// Otherwise all of the load area is loaded and meshed before this returns
+static void world_init(bool progressive) {
+  if (state.mesh_cache.enabled)
+    mesh_cache_init();
   reset_block_vertices();
-  generate_block_mesh();
+  if (progressive) {
+    const Block p = pos_to_block(state.player.pos);
+    push_load_area_changes(p, 0, p, state.world.view_distance);
+  } else {
+    generate_block_mesh();
+    state.startup.playable = true;
+  }
+  if (state.lod.enabled)
+    lod_init(!progressive);
+}
+
+// @benchmarks
+// They are options of the game, and main runs them before sdl_init, so they never open a window or start OpenGL.
+// They also have a build of their own that doesn't need SDL or OpenGL at all (BENCH_ONLY, see build.sh), since
+// world generation, the block loader, meshing and the tasks only use @threads
+
+// run with --bench-edits. Loads the world around the spawn point, and then times a lot of random
+// block edits (remove and place) close to the player, each one remeshed like it would be in a frame,
+// which is the path that has to look up and update where each block face lives in the vertex arrays
+static void benchmark_block_edits() {
+  const int NUM_EDITS = 200000;
+
+  gamestate_init();
+  world_init(false);
+  // so the next run finds the entries, and the disk doesn't slow down the edits
+  mesh_cache_flush();
+
+  Block p = pos_to_block(state.player.pos);
+  srand(1);
+  const u64 start = mine_performance_counter();
+  for (int i = 0; i < NUM_EDITS; ++i) {
+    Block b = {p.x + rand()%64 - 32, p.y + rand()%64 - 32, 1 + rand()%40};
+    set_blocktype_nolock(b, (i&1) ? BLOCKTYPE_AIR : BLOCKTYPE_STONE);
+    update_remesh(0.0f);
+  }
+  const double seconds = (double)(mine_performance_counter() - start) / (double)mine_performance_frequency();
+
+  printf("%i random block edits took %f seconds (%f edits/s, %f us/edit)\n", NUM_EDITS, seconds, NUM_EDITS/seconds, seconds*1e6/NUM_EDITS);
+  printf("opaque vertices: %i, transparent vertices: %i\n", block_mesh_totals(false).vertices, block_mesh_totals(true).vertices);
+  printf("fragmentation: opaque %.1f%%, transparent %.1f%%\n", block_mesh_fragmentation(block_mesh_totals(false))*100.0f, block_mesh_fragmentation(block_mesh_totals(true))*100.0f);
+
+  int frames = 0;
+  while (block_mesh_totals(false).holes || block_mesh_totals(true).holes) {
+    defragment_block_meshes();
+    ++frames;
+  }
+  printf("after %i frames of compaction: opaque vertices: %i, transparent vertices: %i\n", frames, block_mesh_totals(false).vertices, block_mesh_totals(true).vertices);
+
+  // how much the bucket culling saves, looking from the player
+  int total = 0, visible = 0;
+  const BucketView view = bucket_view();
+  for (int t = 0; t < 2; ++t)
+  for (int d = 0; d < DIRECTION_MAX; ++d)
+  for (int i = 0; i < NUM_BLOCK_MESH_SLABS; ++i) {
+    const int n = state.block_meshes[t][d][i].vertices.size;
+    total += n;
+    if (block_mesh_bucket_is_visible((Direction)d, i, state.player.pos + CAMERA_OFFSET_FROM_PLAYER, view))
+      visible += n;
+  }
+  printf("bucket culling: %i of %i vertices (%.1f%%) face the camera\n", visible, total, 100.0f*visible/total);
+}
+
+// run with --bench-mesh. Doesn't need a display, since it never starts SDL video or OpenGL.
+// Generates and meshes all of the load area at a few fixed places in the world (world generation has no seed,
+// so the places are the seeds), and checks a hash of the faces against the one we had before, so that optimizations
+// can't change what gets drawn without anyone noticing. If you change how the world or its faces look on purpose, update the hashes
+struct BenchMeshVolume {
+  v3 pos;
+  u64 hash;
+};
+
+// hash of all faces in range, in world order, so it doesn't depend on where in the meshes they happen to be.
+// The vertices are rounded to integers first, so that compiler flags like -ffast-math don't change the hash
+static u64 hash_block_faces(const BlockRange &range) {
+  u64 h = FNV1A_START;
+  for (int x = range.a.x; x <= range.b.x; ++x)
+  for (int y = range.a.y; y <= range.b.y; ++y)
+  for (int z = range.a.z; z <= range.b.z; ++z) {
+    const BlockIndex bi = block_to_blockindex({x,y,z});
+    if (!get_section(bi)->num_faces)
+      continue;
+    for (int d = 0; d < DIRECTION_MAX; ++d) {
+      int slot;
+      const BlockMesh *mesh = get_block_face_mesh(bi, (Direction)d, &slot);
+      if (!mesh)
+        continue;
+      int face[4 + 4*7] = {x, y, z, d | (mesh >= &state.block_meshes[1][0][0]) << 3};
+      for (int i = 0; i < 4; ++i) {
+        const WorldObjectVertex &v = mesh->vertices[slot*4 + i];
+        int *f = &face[4 + i*7];
+        f[0] = (int)floorf(v.pos.x + 0.5f);
+        f[1] = (int)floorf(v.pos.y + 0.5f);
+        f[2] = (int)floorf(v.pos.z + 0.5f);
+        f[3] = (int)floorf(v.tex.x*4096.0f + 0.5f);
+        f[4] = (int)floorf(v.tex.y*4096.0f + 0.5f);
+        f[5] = (int)floorf(v.occlusion.x*3.0f + 0.5f);
+        f[6] = normal_to_direction(v.normal);
+      }
+      h = fnv1a(h, face, sizeof(face));
+    }
+  }
+  return h;
+}
+
+// returns false if any hash didn't match
+static bool benchmark_meshing() {
+  // world generation is floating point, and at most places in the world -ffast-math changes the terrain a little,
+  // so these are places where it doesn't, and the hashes are the same with and without it
+  static const BenchMeshVolume volumes[] = {
+    {{1000.0f, 1000.0f, 18.0f}, 0x0df430d03e395dcbULL},
+    {{4000.0f, 2500.0f, 18.0f}, 0x1e1e25a9ed5c8a49ULL},
+    {{8000.0f, 4000.0f, 18.0f}, 0xede484adeab4fbc5ULL},
+  };
+
+  // we want to measure meshing, not the cache
+  state.mesh_cache.enabled = false;
+  gamestate_init();
+
+  bool ok = true;
+  double total_generate = 0.0, total_mesh = 0.0;
+  long long total_faces = 0;
+  for (int i = 0; i < (int)ARRAY_LEN(volumes); ++i) {
+    state.player.pos = volumes[i].pos;
+    const BlockRange range = pos_to_range(state.player.pos);
+    reset_block_vertices();
+
+    u64 t0 = mine_performance_counter();
+    const int num_blocks = load_whole_load_area();
+    u64 t1 = mine_performance_counter();
+    update_remesh(INFINITY);
+    u64 t2 = mine_performance_counter();
+
+    const double generate = (double)(t1 - t0) / (double)mine_performance_frequency();
+    const double mesh = (double)(t2 - t1) / (double)mine_performance_frequency();
+    const BlockMeshTotals opaque = block_mesh_totals(false), transparent = block_mesh_totals(true);
+    const int faces = opaque.faces - opaque.holes + transparent.faces - transparent.holes;
+    const double bytes = (double)faces * 4 * sizeof(WorldObjectVertex);
+    const u64 hash = hash_block_faces(range);
+    const bool match = hash == volumes[i].hash;
+    ok &= match;
+    total_generate += generate, total_mesh += mesh, total_faces += faces;
+
+    printf("(%i, %i, %i): generated %i blocks in %.1f ms, meshed %i faces in %.1f ms (%.0f faces/s), %.1f MB of vertices, hash %016llx",
+           (int)volumes[i].pos.x, (int)volumes[i].pos.y, (int)volumes[i].pos.z, num_blocks,
+           generate*1000.0, faces, mesh*1000.0, faces/mesh, bytes/(1024.0*1024.0), (unsigned long long)hash);
+    if (match)
+      printf(" ok\n");
+    else
+      printf(" MISMATCH, expected %016llx\n", (unsigned long long)volumes[i].hash);
+
+    // unload it again, so the next volume starts from nothing. We don't remesh to get rid of the faces,
+    // since the remesh would load the blocks around the ones it looks at again.
+    // Meshing also looked at (and cached the xy data of) the columns right outside the range
+    for (int x = range.a.x - 1; x <= range.b.x + 1; ++x)
+    for (int y = range.a.y - 1; y <= range.b.y + 1; ++y)
+      clear_world_xy_cache(block_to_blockindex({x, y, 0}));
+    for (int x = range.a.x; x <= range.b.x; ++x)
+    for (int y = range.a.y; y <= range.b.y; ++y) {
+      for (int z = range.a.z; z <= range.b.z; ++z) {
+        const BlockIndex bi = block_to_blockindex({x,y,z});
+        for (int d = 0; d < DIRECTION_MAX; ++d)
+          remove_blockface(bi, (Direction)d);
+        block_loader_unload_block({x,y,z});
+        get_section(bi)->residency = SECTION_UNLOADED;
+      }
+    }
+  }
+
+  printf("total: generated in %.1f ms, meshed %lld faces in %.1f ms (%.0f faces/s), peak memory %.1f MB\n",
+         total_generate*1000.0, total_faces, total_mesh*1000.0, total_faces/total_mesh, mine_peak_memory()/(1024.0*1024.0));
+  printf(ok ? "all hashes match\n" : "HASH MISMATCH, the meshes changed\n");
+  return ok;
+}
+
+// run with --bench-tasks. Doesn't need a display either. With more and more workers, times how long a task that does
+// nothing takes to push, run and wait for, how long a fan-out of tasks and a task that waits for them take, and how
+// fast a parallel_for generates the blocks of a piece of the world. The blocks are checked against the ones the main
+// thread generated alone, so it catches tasks that are lost or run twice
+#define BENCH_TASKS_SIZE 256 // columns along x and y that are generated
+#define BENCH_TASKS_HEIGHT 128
+
+static void bench_task_nothing(void*, int, int) {}
+
+struct BenchTasksHash {
+  SpinLock lock;
+  u64 hash;
+};
+
+// a hash of the blocks of some rows of the volume, xored into the BenchTasksHash, so the order doesn't matter
+static void bench_task_generate(void *data, int begin, int end) {
+  u64 h = 0;
+  for (int x = begin; x < end; ++x) {
+    u64 row = FNV1A_START;
+    for (int y = 0; y < BENCH_TASKS_SIZE; ++y) {
+      // we don't want the xy cache, since it would be warm from the last run
+      const WorldXYData xy_data = generate_xy_data(x, y);
+      u8 types[BENCH_TASKS_HEIGHT];
+      for (int z = 0; z < BENCH_TASKS_HEIGHT; ++z)
+        types[z] = (u8)calc_blocktype({x, y, z}, xy_data);
+      row = fnv1a(row, types, sizeof(types));
+    }
+    h ^= row;
+  }
+  BenchTasksHash *hash = (BenchTasksHash*)data;
+  spin_lock(&hash->lock);
+  hash->hash ^= h;
+  spin_unlock(&hash->lock);
+}
+
+static double bench_seconds_since(u64 start) {
+  return (double)(mine_performance_counter() - start) / (double)mine_performance_frequency();
+}
+
+// returns false if the workers generated different blocks than the main thread alone
+static bool benchmark_tasks() {
+  const int NUM_EMPTY_TASKS = 100000;
+  const int NUM_FANOUTS = 2000, FANOUT = 16;
+
+  // the main thread alone, and then up to one worker for every other cpu
+  const int num_cpus = mine_cpu_count();
+  const int max_workers = clamp(num_cpus - 1, 1, MAX_TASK_WORKERS);
+  printf("%i cpus\n", num_cpus);
+  bool ok = true;
+  u64 expected_hash = 0;
+  double one_thread = 0.0;
+  for (int num_workers = 0;; num_workers = min(num_workers ? num_workers*2 : 1, max_workers)) {
+    tasks_init(num_workers);
+    atomic_set(&state.tasks.num_stolen, 0);
+
+    u64 start = mine_performance_counter();
+    TaskCounter counter = {};
+    for (int i = 0; i < NUM_EMPTY_TASKS; ++i)
+      push_task({bench_task_nothing, NULL, 0, 0, &counter});
+    wait_for_tasks(&counter);
+    const double empty = bench_seconds_since(start);
+
+    start = mine_performance_counter();
+    TaskCounter fanout = {}, done = {};
+    for (int i = 0; i < NUM_FANOUTS; ++i) {
+      for (int j = 0; j < FANOUT; ++j)
+        push_task({bench_task_nothing, NULL, 0, 0, &fanout});
+      push_task({bench_task_nothing, NULL, 0, 0, &done}, &fanout);
+      wait_for_tasks(&done);
+    }
+    const double fanouts = bench_seconds_since(start);
+
+    start = mine_performance_counter();
+    BenchTasksHash hash = {};
+    parallel_for(BENCH_TASKS_SIZE, 1, bench_task_generate, &hash);
+    const double generate = bench_seconds_since(start);
+    if (!num_workers)
+      expected_hash = hash.hash, one_thread = generate;
+    const bool match = hash.hash == expected_hash;
+    ok &= match;
+
+    printf("%i workers: an empty task takes %.0f ns, %i tasks and one that waits for them take %.1f us, "
+           "generated %i blocks in %.1f ms (%.2fx), %i tasks stolen%s\n",
+           num_workers, empty*1e9/NUM_EMPTY_TASKS, FANOUT, fanouts*1e6/NUM_FANOUTS,
+           BENCH_TASKS_SIZE*BENCH_TASKS_SIZE*BENCH_TASKS_HEIGHT, generate*1000.0, one_thread/generate,
+           atomic_get(&state.tasks.num_stolen), match ? "" : ", WRONG BLOCKS");
+    array_free(fanout.waiting);
+    array_free(done.waiting);
+    tasks_quit();
+    if (num_workers == max_workers)
+      break;
+  }
+  printf(ok ? "all blocks match\n" : "BLOCKS DIFFER, tasks were lost or run twice\n");
+  return ok;
 }
 
 #ifdef OS_WINDOWS
@@ -4119,14 +7969,31 @@ bool has_commandline_option(int argc, const char *argv[], const char *opt) {
 }
 #endif
 
+// the number after opt, like 200 for --view-distance 200, or def if opt isn't there
+#ifdef OS_WINDOWS
+int commandline_option_int(int argc, wchar_t *argv[], const wchar_t *opt, int def) {
+  for (int i = 1; i + 1 < argc; ++i)
+    if (wcscmp(argv[i], opt) == 0)
+      return _wtoi(argv[i+1]);
+  return def;
+}
+#else
+int commandline_option_int(int argc, const char *argv[], const char *opt, int def) {
+  for (int i = 1; i + 1 < argc; ++i)
+    if (strcmp(argv[i], opt) == 0)
+      return atoi(argv[i+1]);
+  return def;
+}
+#endif
+
 static void render_world_to_gbuffer(const m4 &view, const m4 &proj) {
   const m4 viewprojection = proj * view;
+  // where the camera is. Not always camera_pos, in vr every eye has its own
+  const m4 inverse_view = m4_invert(view);
+  const v3 eye = {inverse_view.d[3], inverse_view.d[7], inverse_view.d[11]};
 
   // resend block vertices to gpu if they changed
-  if (state.block_vertices_dirty) {
-    state.opaque_block_vb.set_data(state.block_vertices.items, state.block_vertices.size, state.block_elements.items, state.block_elements.size);
-    state.block_vertices_dirty = false;
-  }
+  upload_block_meshes(false);
 
   // calculate sun/moon position, and direction
   calculate_directional_light();
@@ -4137,17 +8004,26 @@ static void render_world_to_gbuffer(const m4 &view, const m4 &proj) {
   // render shadowmap to gbuffer
   render_shadowmap();
 
-  // render opaque blocks to gbuffer
-  render_opaque_blocks(viewprojection);
+  // render opaque blocks to gbuffer, in front of the far terrain (see @depthranges)
+  set_depth_range(DEPTH_RANGE_NEAR);
+  render_opaque_blocks(viewprojection, eye);
+
+  // render the tool you are holding, and other voxel models
+  render_tool();
+  render_voxel_models(viewprojection);
 
-  // render the tool you are holding
-  render_tool(proj);
+  // render the far terrain to gbuffer, after everything in front of it so most of it fails the depth test early
+  const m4 far_viewprojection = far_terrain_projection(proj) * view;
+  set_depth_range(DEPTH_RANGE_FAR);
+  render_far_terrain(far_viewprojection);
 
   // render skybox to gbuffer
   render_skybox(view, proj);
 
   // render transparent blocks to gbuffer
-  render_transparent_blocks(viewprojection);
+  set_depth_range(DEPTH_RANGE_NEAR);
+  render_transparent_blocks(viewprojection, far_viewprojection, eye);
+  set_depth_range(DEPTH_RANGE_ALL);
 }
 
 #ifdef VR_ENABLED
@@ -4275,6 +8151,7 @@ static void render_world_vr(const m4 view, const m4 proj) {
 }
 #endif
 
+#ifndef BENCH_ONLY
 static void render(const m4& view, const m4& proj) {
   #ifdef VR_ENABLED
   if (state.vr_enabled) {
@@ -4295,6 +8172,7 @@ static void render(const m4& view, const m4& proj) {
   SDL_GL_SwapWindow(state.window);
   gl_ok_or_die;
 }
+#endif
 
 // on windows, you can't just use main for some reason.
 // instead, you need to use WinMain, or wmain, or wWinMain. pick your poison ;)
@@ -4302,11 +8180,64 @@ static void render(const m4& view, const m4& proj) {
   // int WINAPI wWinMain(HINSTANCE /*hInstance*/, HINSTANCE /*hPrevInstance*/, PWSTR /*pCmdLine*/, int /*nCmdShow*/) {
   #define mine_main int wmain(int argc, wchar_t *argv[], wchar_t *[] )
 #else
-  #define mine_main int main(int, const char *[])
+  #define mine_main int main(int argc, const char *argv[])
 #endif
 
 mine_main {
-  printf("%lu %lu %lu %lu %lu\n", sizeof(state)/1024/1024, sizeof(state.block_vertex_pos)/1024/1024, sizeof(state.world.block_types)/1024/1024, sizeof(state.block_vertices)/1024/1024, sizeof(state.block_elements)/1024/1024);
+  state.startup.start = mine_performance_counter();
+  // the block caches aren't in here, see reset_block_cache
+  printf("%lu %lu %lu\n", sizeof(state)/1024/1024, sizeof(state.block_meshes)/1024/1024, sizeof(state.block_vbs)/1024/1024);
+  #ifdef OS_WINDOWS
+  state.mesh_cache.budget = (u64)max(commandline_option_int(argc, argv, L"--mesh-cache-budget", DEFAULT_MESH_CACHE_BUDGET), 0) << 20;
+  state.mesh_cache.enabled = state.mesh_cache.budget && !has_commandline_option(argc, argv, L"--no-mesh-cache");
+  state.lod.enabled = !has_commandline_option(argc, argv, L"--no-lod");
+  state.far_terrain.enabled = state.lod.enabled && !has_commandline_option(argc, argv, L"--no-far-terrain");
+  state.world.ram_budget = commandline_option_int(argc, argv, L"--ram-budget", 0);
+  state.world.vram_budget = commandline_option_int(argc, argv, L"--vram-budget", 0);
+  state.world.view_distance = commandline_option_int(argc, argv, L"--view-distance", state.world.ram_budget || state.world.vram_budget ? MAX_VIEW_DISTANCE : DEFAULT_VIEW_DISTANCE);
+  state.world.unload_margin = max(commandline_option_int(argc, argv, L"--unload-margin", DEFAULT_UNLOAD_MARGIN), 0);
+  state.teleport_key = has_commandline_option(argc, argv, L"--teleport-key");
+  #else
+  // see @meshcache. A budget of 0 turns it off, like --no-mesh-cache
+  state.mesh_cache.budget = (u64)max(commandline_option_int(argc, argv, "--mesh-cache-budget", DEFAULT_MESH_CACHE_BUDGET), 0) << 20;
+  state.mesh_cache.enabled = state.mesh_cache.budget && !has_commandline_option(argc, argv, "--no-mesh-cache");
+  state.lod.enabled = !has_commandline_option(argc, argv, "--no-lod");
+  // far terrain is drawn around the lod chunks, so it needs them
+  state.far_terrain.enabled = state.lod.enabled && !has_commandline_option(argc, argv, "--no-far-terrain");
+  // see @viewdistance. With a memory budget, we go as far as fits in it, unless you ask for less
+  state.world.ram_budget = commandline_option_int(argc, argv, "--ram-budget", 0);
+  state.world.vram_budget = commandline_option_int(argc, argv, "--vram-budget", 0);
+  state.world.view_distance = commandline_option_int(argc, argv, "--view-distance", state.world.ram_budget || state.world.vram_budget ? MAX_VIEW_DISTANCE : DEFAULT_VIEW_DISTANCE);
+  // see @residency
+  state.world.unload_margin = max(commandline_option_int(argc, argv, "--unload-margin", DEFAULT_UNLOAD_MARGIN), 0);
+  // see @teleport
+  state.teleport_key = has_commandline_option(argc, argv, "--teleport-key");
+  #endif
+  #ifdef OS_WINDOWS
+  if (has_commandline_option(argc, argv, L"--bench-edits")) {
+  #else
+  if (has_commandline_option(argc, argv, "--bench-edits")) {
+  #endif
+    benchmark_block_edits();
+    return 0;
+  }
+  #ifdef OS_WINDOWS
+  if (has_commandline_option(argc, argv, L"--bench-mesh"))
+  #else
+  if (has_commandline_option(argc, argv, "--bench-mesh"))
+  #endif
+    return benchmark_meshing() ? 0 : 1;
+  #ifdef OS_WINDOWS
+  if (has_commandline_option(argc, argv, L"--bench-tasks"))
+  #else
+  if (has_commandline_option(argc, argv, "--bench-tasks"))
+  #endif
+    return benchmark_tasks() ? 0 : 1;
+
+  #ifdef BENCH_ONLY
+  printf("This build only has the benchmarks: run it with --bench-edits, --bench-mesh or --bench-tasks\n");
+  return 1;
+  #else
   sdl_init();
 
   #ifdef VR_ENABLED
@@ -4321,12 +8252,13 @@ mine_main {
 
   // gl buffers, shaders, framebuffers
   block_graphics_init();
-  tool_graphics_init();
+  voxel_model_graphics_init();
   shadowmap_init();
   post_processing_init();
   ui_graphics_init();
   text_graphics_init();
   skybox_init();
+  clouds_init();
 
   // some gl settings
   glDepthFunc(GL_LEQUAL);
@@ -4338,11 +8270,13 @@ mine_main {
   glEnable(GL_FRAMEBUFFER_SRGB);
   #endif
 
-  // initialize game state
-  world_init();
+  // initialize game state. The world is loaded while we draw frames, see @startup
+  world_init(true);
 
-  // create the thread in charge of loading blocks
-  SDL_CreateThread(blockloader_thread, "block loader", 0);
+  // create the threads meshing far away terrain. The blocks are loaded by the task workers, see gamestate_init
+  if (state.lod.enabled)
+    for (int i = 0; i < TERRAIN_NUM_THREADS; ++i)
+      thread_create(terrain_thread, 0);
 
   // @mainloop
   int time = SDL_GetTicks()-16;
@@ -4363,6 +8297,14 @@ mine_main {
     // handle input
     if (state.keypressed[KEY_ESCAPE])
       shutdown(0);
+    if (state.keypressed[KEY_VIEW_FARTHER])
+      set_view_distance(state.world.view_distance + VIEW_DISTANCE_STEP);
+    if (state.keypressed[KEY_VIEW_NEARER])
+      set_view_distance(state.world.view_distance - VIEW_DISTANCE_STEP);
+    if (state.keypressed[KEY_TELEPORT] && state.teleport_key && state.startup.playable) {
+      const v3 p = state.player.pos + camera_forward(&state.camera, TELEPORT_KEY_DISTANCE);
+      teleport((int)floorf(p.x), (int)floorf(p.y));
+    }
 
     // update @inventory
     update_inventory();
@@ -4370,6 +8312,12 @@ mine_main {
     // update water texture
     update_water_texture(dt);
 
+    // move the clouds with the wind
+    update_clouds(dt);
+
+    // bob the tool you are holding
+    update_tool(dt);
+
     // update player
     v3 before = state.player.pos;
     update_player(dt);
@@ -4378,6 +8326,21 @@ mine_main {
     // hide and show blocks that went in and out of scope
     update_blocks(before, after);
 
+    // give the block loader the most urgent of its jobs
+    update_block_loader_jobs();
+
+    // rebuild the faces of blocks that changed
+    update_remesh(state.startup.playable ? REMESH_BUDGET_MS : STARTUP_REMESH_BUDGET_MS);
+
+    // let the player go once the world around them is there
+    update_startup();
+
+    // fill holes left by removed block faces
+    defragment_block_meshes();
+
+    // pick lod levels and upload finished lod meshes
+    update_lod();
+
     // debug prints
     debug_prints(loopindex, dt);
 
@@ -4394,7 +8357,10 @@ mine_main {
     const m4 proj = camera_projection_matrix(&state.camera, state.fov, state.nearz, state.farz, state.screen_ratio);
 
     render(view, proj);
+    if (!loopindex)
+      printf("startup: first frame after %.0f ms\n", startup_ms());
   }
 
   return 0;
+  #endif
 }